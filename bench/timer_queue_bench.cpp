@@ -0,0 +1,95 @@
+#include "heap_timer_queue.h"
+#include "tree_timer_queue.h"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+using TimePoint = TimerQueue::TimePoint;
+
+std::unique_ptr<TimerQueue> make_queue(TimerQueueBackend backend, size_t timers) {
+    if (backend == TimerQueueBackend::Heap) {
+        return std::unique_ptr<TimerQueue>(new HeapTimerQueue(timers));
+    }
+    return std::unique_ptr<TimerQueue>(new TreeTimerQueue(timers));
+}
+
+TimerData make_timer(TimerData::Id id) {
+    return TimerData{TimerCallback(), id};
+}
+
+/**
+ * Queue filled with n timers spread over 10 s, expiries drawn from a fixed seed
+ */
+struct Filled {
+    Filled(TimerQueueBackend backend, size_t n) : queue(make_queue(backend, n)), rng(42) {
+        timers.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            timers.push_back(queue->push(next_expiry(), make_timer(i + 1)));
+        }
+    }
+
+    TimePoint next_expiry() {
+        return base + std::chrono::microseconds(delay(rng));
+    }
+
+    TimePoint base = TimePoint() + std::chrono::hours(1);
+    std::unique_ptr<TimerQueue> queue;
+    std::vector<TimerData*> timers;
+    std::mt19937_64 rng;
+    std::uniform_int_distribution<int64_t> delay{0, 10000000};
+};
+
+// Steady state of a busy queue: fire the earliest timer and rearm it further away
+void BM_PopRearm(benchmark::State& state, TimerQueueBackend backend) {
+    Filled filled(backend, size_t(state.range(0)));
+    TimePoint expiry;
+    for (auto _ : state) {
+        TimerData* data = filled.queue->pop_expired(TimePoint::max(), expiry);
+        filled.base = expiry;
+        filled.queue->rearm(data, filled.next_expiry());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Cancel a random armed timer and schedule a new one in its place
+void BM_CancelPush(benchmark::State& state, TimerQueueBackend backend) {
+    Filled filled(backend, size_t(state.range(0)));
+    std::uniform_int_distribution<size_t> pick(0, filled.timers.size() - 1);
+    TimerData::Id next_id = filled.timers.size() + 1;
+    for (auto _ : state) {
+        TimerData*& victim = filled.timers[pick(filled.rng)];
+        filled.queue->erase(victim);
+        victim = filled.queue->push(filled.next_expiry(), make_timer(next_id++));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Move a random armed timer to a new expiry, as a reset idle timeout does
+void BM_Reposition(benchmark::State& state, TimerQueueBackend backend) {
+    Filled filled(backend, size_t(state.range(0)));
+    std::uniform_int_distribution<size_t> pick(0, filled.timers.size() - 1);
+    for (auto _ : state) {
+        filled.queue->reposition(filled.timers[pick(filled.rng)], filled.next_expiry());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void sizes(benchmark::internal::Benchmark* bench) {
+    bench->Arg(1000)->Arg(100000)->Arg(10000000)->Unit(benchmark::kNanosecond);
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_PopRearm, tree, TimerQueueBackend::Tree)->Apply(sizes);
+BENCHMARK_CAPTURE(BM_PopRearm, heap, TimerQueueBackend::Heap)->Apply(sizes);
+BENCHMARK_CAPTURE(BM_CancelPush, tree, TimerQueueBackend::Tree)->Apply(sizes);
+BENCHMARK_CAPTURE(BM_CancelPush, heap, TimerQueueBackend::Heap)->Apply(sizes);
+BENCHMARK_CAPTURE(BM_Reposition, tree, TimerQueueBackend::Tree)->Apply(sizes);
+BENCHMARK_CAPTURE(BM_Reposition, heap, TimerQueueBackend::Heap)->Apply(sizes);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,306 @@
+#include "sharded_timer_service.h"
+#include "timer_service.h"
+#include "typed_timer_service.h"
+
+#include <benchmark/benchmark.h>
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+// Bytes requested from the global allocator, for the memory per timer benchmark
+std::atomic<size_t> allocated_bytes{0};
+
+constexpr std::chrono::milliseconds kFarAway = std::chrono::hours(1);
+constexpr size_t kScheduleRound = 65536;
+
+using TimerId = TimerService::TimerId;
+
+void noop(int) {}
+
+TimerServiceConfig config_for(TimerQueueBackend backend) {
+    TimerServiceConfig config;
+    config.backend = backend;
+    return config;
+}
+
+// Voluntary and involuntary context switches of the whole process so far, worker threads included
+long context_switches() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+void wait_for(const std::atomic<size_t>& counter, size_t value) {
+    while (counter.load(std::memory_order_acquire) < value) {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * Service shared by the producer threads of a schedule benchmark
+ */
+struct ScheduleTarget {
+    virtual ~ScheduleTarget() = default;
+    virtual TimerId schedule() = 0;
+    virtual void cancel(const std::vector<TimerId>& ids) = 0;
+};
+
+template<typename Service>
+struct ServiceTarget : ScheduleTarget {
+    template<typename Config>
+    explicit ServiceTarget(const Config& config) : service(config) {}
+
+    TimerId schedule() override { return service.schedule(kFarAway, noop, 0); }
+    void cancel(const std::vector<TimerId>& ids) override { service.cancel_batch(ids); }
+
+    Service service;
+};
+
+enum class Target { Locked, LockFree, Sharded };
+
+std::unique_ptr<ScheduleTarget> make_target(Target target) {
+    TimerServiceConfig config;
+    switch (target) {
+    case Target::LockFree:
+        config.lock_free_submission = true;
+        return std::unique_ptr<ScheduleTarget>(new ServiceTarget<TimerService>(config));
+    case Target::Sharded: {
+        ShardedTimerServiceConfig sharded;
+        sharded.shard = config;
+        return std::unique_ptr<ScheduleTarget>(new ServiceTarget<ShardedTimerService>(sharded));
+    }
+    case Target::Locked:
+    default:
+        return std::unique_ptr<ScheduleTarget>(new ServiceTarget<TimerService>(config));
+    }
+}
+
+std::unique_ptr<ScheduleTarget> shared_target;
+
+// Schedule throughput across producer threads, timers are cancelled every round to bound memory.
+// Reports the context switches per schedule, spurious worker wake-ups show up there.
+void BM_Schedule(benchmark::State& state, Target target) {
+    long switches = 0;
+    if (state.thread_index() == 0) {
+        shared_target = make_target(target);
+        switches = context_switches();
+    }
+    std::vector<TimerId> ids;
+    ids.reserve(kScheduleRound);
+    for (auto _ : state) {
+        ids.push_back(shared_target->schedule());
+        if (ids.size() == kScheduleRound) {
+            state.PauseTiming();
+            shared_target->cancel(ids);
+            ids.clear();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        state.counters["switches_per_op"] = double(context_switches() - switches) /
+                                            double(state.iterations() * state.threads());
+        shared_target.reset();
+    }
+}
+
+// Cancel cost against the number of armed timers, the queue is refilled when exhausted
+void BM_Cancel(benchmark::State& state, TimerQueueBackend backend) {
+    TimerService service(config_for(backend));
+    size_t timers = size_t(state.range(0));
+    std::vector<TimerId> ids;
+    ids.reserve(timers);
+    size_t next = 0;
+    for (auto _ : state) {
+        if (next == ids.size()) {
+            state.PauseTiming();
+            ids.clear();
+            while (ids.size() < timers) {
+                ids.push_back(service.schedule(kFarAway, noop, 0));
+            }
+            next = 0;
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(service.cancel(ids[next++]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Time from a common expiry to the last callback of a burst of timers sharing it
+void BM_FireBurst(benchmark::State& state, TimerQueueBackend backend) {
+    TimerService service(config_for(backend));
+    size_t burst = size_t(state.range(0));
+    std::atomic<size_t> fired{0};
+    auto count = [&fired](int) { fired.fetch_add(1, std::memory_order_release); };
+    std::vector<std::tuple<std::chrono::milliseconds, decltype(count), int, int>> timers(
+        burst, std::make_tuple(std::chrono::milliseconds(20), count, 0, 0));
+    for (auto _ : state) {
+        fired = 0;
+        auto expiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+        service.schedule_batch(timers);
+        wait_for(fired, burst);
+        state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - expiry).count());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Rearm cost of a repeating timer with a zero period, firing back to back
+void BM_Rearm(benchmark::State& state, TimerQueueBackend backend) {
+    TimerService service(config_for(backend));
+    const int repeats = 10000;
+    std::atomic<size_t> fired{0};
+    auto count = [&fired](int) { fired.fetch_add(1, std::memory_order_release); };
+    for (auto _ : state) {
+        fired = 0;
+        service.schedule(std::chrono::milliseconds(0), count, 0, repeats);
+        wait_for(fired, repeats + 1);
+    }
+    state.SetItemsProcessed(state.iterations() * (repeats + 1));
+}
+
+// Heap memory held per armed timer, queue and index included
+void BM_MemoryPerTimer(benchmark::State& state, TimerQueueBackend backend) {
+    size_t timers = size_t(state.range(0));
+    for (auto _ : state) {
+        TimerService service(config_for(backend));
+        size_t before = allocated_bytes.load();
+        for (size_t i = 0; i < timers; ++i) {
+            service.schedule(kFarAway, noop, 0);
+        }
+        state.counters["bytes_per_timer"] = double(allocated_bytes.load() - before) / double(timers);
+        state.counters["reported_bytes_per_timer"] = service.memory_usage().bytes_per_timer();
+    }
+}
+
+// Warm restart: arming timers saved by snapshot(), against scheduling them one by one
+enum class Restart { Restore, Reschedule };
+
+void BM_WarmRestart(benchmark::State& state, TimerQueueBackend backend, Restart restart) {
+    size_t timers = size_t(state.range(0));
+    const char* path = "timer_service_bench.snap";
+    TimerHandlerRegistry handlers;
+    const TimerHandler& handler = handlers.add<int>("bench", noop);
+    std::vector<std::chrono::milliseconds> delays;
+    std::mt19937 random(1);
+    for (size_t i = 0; i < timers; ++i) {
+        delays.push_back(kFarAway + std::chrono::milliseconds(random() % 1000000));
+    }
+    {
+        TimerService service(config_for(backend));
+        for (size_t i = 0; i < timers; ++i) {
+            service.schedule_persistent(delays[i], handler, int(i));
+        }
+        service.snapshot(path);
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::unique_ptr<TimerService> service(new TimerService(config_for(backend)));
+        state.ResumeTiming();
+        if (restart == Restart::Restore) {
+            service->restore(path, handlers);
+        } else {
+            for (size_t i = 0; i < timers; ++i) {
+                service->schedule_persistent(delays[i], handler, int(i));
+            }
+        }
+        state.PauseTiming();
+        service.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(timers));
+    std::remove(path);
+}
+
+void BM_Restore(benchmark::State& state, TimerQueueBackend backend) {
+    BM_WarmRestart(state, backend, Restart::Restore);
+}
+
+void BM_Reschedule(benchmark::State& state, TimerQueueBackend backend) {
+    BM_WarmRestart(state, backend, Restart::Reschedule);
+}
+
+// Handler of the typed service benchmarks, a plain struct so that the call is direct
+struct CountHandler {
+    std::atomic<size_t>* fired;
+    void operator()(int) const { fired->fetch_add(1, std::memory_order_release); }
+};
+
+using TypedService = TypedTimerService<CountHandler, int>;
+
+// BM_Rearm on the typed service: dispatch and rearm without the type-erased callback
+void BM_TypedRearm(benchmark::State& state) {
+    std::atomic<size_t> fired{0};
+    TypedService service(CountHandler{&fired});
+    const int repeats = 10000;
+    for (auto _ : state) {
+        fired = 0;
+        service.schedule(std::chrono::milliseconds(0), 0, repeats);
+        wait_for(fired, repeats + 1);
+    }
+    state.SetItemsProcessed(state.iterations() * (repeats + 1));
+}
+
+// BM_MemoryPerTimer on the typed service
+void BM_TypedMemoryPerTimer(benchmark::State& state) {
+    size_t timers = size_t(state.range(0));
+    std::atomic<size_t> fired{0};
+    for (auto _ : state) {
+        TypedService service(CountHandler{&fired});
+        size_t before = allocated_bytes.load();
+        for (size_t i = 0; i < timers; ++i) {
+            service.schedule(kFarAway, 0);
+        }
+        state.counters["bytes_per_timer"] = double(allocated_bytes.load() - before) / double(timers);
+    }
+}
+
+} // namespace
+
+// Kept out of line, GCC flags free() on memory from operator new once they are inlined
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+BENCHMARK_CAPTURE(BM_Schedule, locked, Target::Locked)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Schedule, lock_free, Target::LockFree)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Schedule, sharded, Target::Sharded)->ThreadRange(1, 8)->UseRealTime();
+
+#define TIMER_SERVICE_BENCH_BACKENDS(bench, ...)                                        \
+    BENCHMARK_CAPTURE(bench, tree, TimerQueueBackend::Tree)->__VA_ARGS__;               \
+    BENCHMARK_CAPTURE(bench, heap, TimerQueueBackend::Heap)->__VA_ARGS__;               \
+    BENCHMARK_CAPTURE(bench, wheel, TimerQueueBackend::Wheel)->__VA_ARGS__
+
+TIMER_SERVICE_BENCH_BACKENDS(BM_Cancel, Arg(1000)->Arg(100000)->Arg(1000000));
+TIMER_SERVICE_BENCH_BACKENDS(BM_FireBurst, Arg(1000)->Arg(100000)->UseManualTime()->Unit(benchmark::kMicrosecond));
+TIMER_SERVICE_BENCH_BACKENDS(BM_Rearm, UseRealTime()->Unit(benchmark::kMicrosecond));
+TIMER_SERVICE_BENCH_BACKENDS(BM_MemoryPerTimer, Arg(1000)->Arg(100000)->Arg(1000000)->Iterations(1));
+TIMER_SERVICE_BENCH_BACKENDS(BM_Restore, Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond));
+TIMER_SERVICE_BENCH_BACKENDS(BM_Reschedule, Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond));
+BENCHMARK(BM_TypedRearm)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_TypedMemoryPerTimer)->Arg(1000)->Arg(100000)->Arg(1000000)->Iterations(1);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,87 @@
+#include "callback_executor.h"
+
+#include "test_check.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+TEST_CASE(executor_runs_every_task) {
+    std::atomic<int> ran{0};
+    {
+        CallbackExecutor executor(2);
+        for (int i = 0; i < 1000; ++i) {
+            executor.submit([&ran] { ran++; }, uint64_t(i % 3));
+        }
+        executor.stop(true);
+    }
+    CHECK(ran == 1000);
+}
+
+TEST_CASE(executor_serial_tasks_run_in_order) {
+    std::vector<int> order;
+    CallbackExecutor executor(4);
+    for (int i = 0; i < 1000; ++i) {
+        executor.submit([&order, i] { order.push_back(i); }, 7);
+    }
+    executor.stop(true);
+    REQUIRE(order.size() == 1000u);
+    for (int i = 0; i < 1000; ++i) {
+        CHECK(order[size_t(i)] == i);
+    }
+}
+
+// pending() is scraped concurrently as a saturation metric: a task taken as soon as it is
+// queued must never make it wrap below zero
+TEST_CASE(executor_pending_never_wraps) {
+    CallbackExecutor executor(2);
+    const size_t tasks = 200000;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> max_seen{0};
+    std::thread sampler([&] {
+        while (!done) {
+            size_t pending = executor.pending();
+            if (pending > max_seen) {
+                max_seen = pending;
+            }
+        }
+    });
+    for (size_t i = 0; i < tasks; ++i) {
+        executor.submit([] {});
+    }
+    executor.stop(true);
+    done = true;
+    sampler.join();
+    CHECK(max_seen <= tasks);
+    CHECK(executor.pending() == 0u);
+}
+
+// Stopping without drain lets the running task finish and destroys the queued ones unrun
+TEST_CASE(executor_stop_drops_queued_tasks) {
+    CallbackExecutor executor(1);
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    std::atomic<int> ran{0};
+    executor.submit([&] {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    }, 1); // Pinned, the thread takes it before the ones queued behind it
+    for (int i = 0; i < 100; ++i) {
+        executor.submit([&ran] { ran++; }, uint64_t(i % 2));
+    }
+    while (!started) {
+        std::this_thread::yield();
+    }
+    std::thread stopper([&executor] { executor.stop(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); // Let stop() flag the threads
+    release = true;
+    stopper.join();
+    CHECK(ran == 0);
+    CHECK(executor.pending() == 0u);
+}
+
+int main() {
+    return run_tests();
+}
@@ -0,0 +1,80 @@
+#include "indexed_heap.h"
+
+#include "test_check.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kDetached = UINT32_MAX;
+
+struct Key {
+    int64_t key;
+    uint32_t slot;
+};
+
+struct Position {
+    std::vector<uint32_t>* positions;
+    uint32_t& operator()(uint32_t slot) const { return (*positions)[slot]; }
+};
+
+} // namespace
+
+// Random pushes, removals and updates, checked against an ordered reference after every step
+TEST_CASE(indexed_heap_matches_reference) {
+    const uint32_t slots = 512;
+    std::vector<uint32_t> positions(slots, kDetached);
+    std::vector<int64_t> keys(slots);
+    IndexedHeap<Key, Position> heap(Position{&positions});
+    std::multimap<int64_t, uint32_t> reference;
+    std::mt19937 rng(7);
+
+    for (int step = 0; step < 20000; ++step) {
+        uint32_t slot = rng() % slots;
+        int64_t key = int64_t(rng() % 1000);
+        if (positions[slot] == kDetached) {
+            heap.push(Key{key, slot});
+            keys[slot] = key;
+            reference.emplace(key, slot);
+        } else {
+            auto range = reference.equal_range(keys[slot]);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == slot) {
+                    reference.erase(it);
+                    break;
+                }
+            }
+            if (rng() % 2) {
+                CHECK(heap.remove(positions[slot]) == slot);
+                positions[slot] = kDetached;
+            } else {
+                heap.update(positions[slot], key);
+                keys[slot] = key;
+                reference.emplace(key, slot);
+            }
+        }
+
+        REQUIRE(heap.size() == reference.size());
+        for (uint32_t pos = 0; pos < heap.size(); ++pos) {
+            REQUIRE(positions[heap[pos].slot] == pos);
+            REQUIRE(keys[heap[pos].slot] == heap[pos].key);
+        }
+        if (!heap.empty()) {
+            REQUIRE(heap.front().key == reference.begin()->first);
+        }
+    }
+
+    // Popping the front drains in order
+    int64_t previous = INT64_MIN;
+    while (!heap.empty()) {
+        CHECK(heap.front().key >= previous);
+        previous = heap.front().key;
+        positions[heap.remove(0)] = kDetached;
+    }
+}
+
+int main() {
+    return run_tests();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+/**
+ * Minimal test harness, so that the tests build without any dependency: TEST_CASE registers
+ * a case, CHECK reports a failed condition and fails the case, run_tests() runs them all.
+ */
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<TestCase>& test_cases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+inline bool& test_failed() {
+    static bool failed = false;
+    return failed;
+}
+
+struct TestRegistration {
+    TestRegistration(const char* name, void (*run)()) { test_cases().push_back(TestCase{name, run}); }
+};
+
+#define TEST_CASE(name)                                        \
+    static void name();                                        \
+    static TestRegistration name##_registration(#name, &name); \
+    static void name()
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            test_failed() = true;                                                     \
+        }                                                                             \
+    } while (0)
+
+// Stops the case at the first failure, for conditions the rest of the case relies on
+#define REQUIRE(condition)    \
+    do {                      \
+        CHECK(condition);     \
+        if (test_failed()) {  \
+            return;           \
+        }                     \
+    } while (0)
+
+inline int run_tests() {
+    int failures = 0;
+    for (const TestCase& test : test_cases()) {
+        test_failed() = false;
+        test.run();
+        std::printf("%s %s\n", test_failed() ? "FAILED" : "passed", test.name);
+        failures += test_failed() ? 1 : 0;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,498 @@
+#include "timer_service.h"
+
+#include "test_check.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#endif
+
+using namespace std::chrono_literals;
+
+#ifdef __linux__
+namespace {
+
+bool readable(int fd, int timeout_ms) {
+    pollfd entry{fd, POLLIN, 0};
+    return ::poll(&entry, 1, timeout_ms) == 1;
+}
+
+} // namespace
+
+// A host loop passing a time cached before its poll processes nothing, the fd must still be
+// armed again for the timer it was woken up for
+TEST_CASE(threadless_fd_rearmed_when_woken_before_expiry) {
+    TimerServiceConfig config;
+    config.threadless = true;
+    TimerService service(config);
+    REQUIRE(service.fd() >= 0);
+
+    int fired = 0;
+    service.schedule(10ms, [&fired](int) { ++fired; }, 0);
+    std::chrono::steady_clock::time_point cached = service.now();
+    REQUIRE(readable(service.fd(), 1000));
+    CHECK(service.process_expired(cached) == 0u);
+
+    REQUIRE(readable(service.fd(), 1000));
+    CHECK(service.process_expired() == 1u);
+    CHECK(fired == 1);
+}
+#endif
+
+// shutdown() is idempotent: callers racing the first one wait for it instead of joining again
+TEST_CASE(shutdown_concurrent_callers) {
+    for (int round = 0; round < 20; ++round) {
+        TimerServiceConfig config;
+        config.executor_threads = 2;
+        config.shutdown = ShutdownPolicy::Flush;
+        TimerService service(config);
+        std::atomic<int> fired{0};
+        for (int i = 0; i < 100; ++i) {
+            service.schedule(std::chrono::hours(1), [&fired](int) { fired++; }, i);
+        }
+        std::atomic<int> returned{0};
+        std::vector<std::thread> callers;
+        for (int i = 0; i < 4; ++i) {
+            callers.emplace_back([&] {
+                service.shutdown();
+                // Whichever call returns, the flush is complete
+                CHECK(fired == 100);
+                returned++;
+            });
+        }
+        for (std::thread& caller : callers) {
+            caller.join();
+        }
+        CHECK(returned == 4);
+        service.shutdown();
+    }
+}
+
+TEST_CASE(shutdown_discards_armed_timers) {
+    std::atomic<int> fired{0};
+    {
+        TimerService service;
+        service.schedule(std::chrono::hours(1), [&fired](int) { fired++; }, 0);
+        service.shutdown();
+        service.shutdown();
+    }
+    CHECK(fired == 0);
+}
+
+// Discard lets the running callback finish, the ones queued behind it on the executor never run
+TEST_CASE(shutdown_discard_drops_queued_callbacks) {
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    std::atomic<int> fired{0};
+    {
+        TimerServiceConfig config;
+        config.executor_threads = 1;
+        config.shutdown = ShutdownPolicy::Discard;
+        TimerService service(config);
+        service.schedule(1ms, [&](int) {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        }, 0);
+        while (!started) {
+            std::this_thread::yield();
+        }
+        for (int i = 0; i < 100; ++i) {
+            service.schedule(1ms, [&fired](int) { fired++; }, i);
+        }
+        while (service.pending_callbacks() < 100) {
+            std::this_thread::sleep_for(1ms);
+        }
+        std::thread stopper([&service] { service.shutdown(); });
+        std::this_thread::sleep_for(100ms); // Let shutdown() stop the executor
+        release = true;
+        stopper.join();
+        CHECK(service.pending_callbacks() == 0u);
+    }
+    CHECK(fired == 0);
+}
+
+// A timer held in the fire limit backlog has not fired, rescheduling it requeues it for later
+TEST_CASE(reschedule_backlogged_timer) {
+    TimerServiceConfig config;
+    config.fire_limit = 1;
+    config.fire_interval = 300ms;
+    TimerService service(config);
+    std::atomic<int> first{0};
+    std::atomic<int> second{0};
+    service.schedule(1ms, [&first](int) { first++; }, 0);
+    while (first == 0) {
+        std::this_thread::sleep_for(1ms);
+    }
+    // The interval budget is spent, this one waits in the backlog
+    TimerService::TimerId id = service.schedule(1ms, [&second](int) { second++; }, 0);
+    std::this_thread::sleep_for(50ms);
+    std::chrono::steady_clock::time_point rescheduled = std::chrono::steady_clock::now();
+    REQUIRE(service.reschedule(id, 1s));
+    std::this_thread::sleep_for(500ms); // Past the interval the backlog would have fired in
+    CHECK(second == 0);
+    while (second == 0 && std::chrono::steady_clock::now() - rescheduled < 5s) {
+        std::this_thread::sleep_for(1ms);
+    }
+    CHECK(second == 1);
+    CHECK(std::chrono::steady_clock::now() - rescheduled >= 1s);
+}
+
+// A slack beyond what a timer holds is capped rather than wrapped to a negative one
+TEST_CASE(slack_capped_not_wrapped) {
+    TimerServiceConfig config;
+    config.backend = TimerQueueBackend::Wheel;
+    config.manual_clock = true;
+    TimerService service(config);
+    TimerOptions options;
+    options.slack = std::chrono::hours(24 * 30);
+    int fired = 0;
+    service.schedule(1ms, [&fired](int) { ++fired; }, 0, 0, options);
+    // Wrapped negative, the timer would fire at 1 ms; capped, the wheel aligns it days later
+    CHECK(service.advance(1s) == 0u);
+    CHECK(service.advance(std::chrono::hours(24 * 25)) == 1u);
+    CHECK(fired == 1);
+}
+
+namespace {
+
+TimerServiceConfig manual_config() {
+    TimerServiceConfig config;
+    config.manual_clock = true;
+    return config;
+}
+
+} // namespace
+
+// Moving a timer earlier requeues it, moving it later is applied when the old expiry comes due
+TEST_CASE(reschedule_moves_armed_timer) {
+    TimerService service(manual_config());
+    int fired = 0;
+    TimerService::TimerId early = service.schedule(10ms, [&fired](int) { ++fired; }, 0);
+    TimerService::TimerId late = service.schedule(5ms, [&fired](int) { fired += 10; }, 0);
+    CHECK(service.reschedule(early, 2ms));
+    CHECK(service.reschedule(late, 20ms));
+    CHECK(service.advance(2ms) == 1u);
+    CHECK(fired == 1);
+    CHECK(service.advance(17ms) == 0u); // Past the first expiry of the late one
+    CHECK(service.advance(1ms) == 1u);
+    CHECK(fired == 11);
+    CHECK(!service.reschedule(early, 1ms)); // Fired, its id is stale
+    CHECK(service.stats().queue_depth == 0u);
+}
+
+// reset() restarts the delay the timer was scheduled with, from now
+TEST_CASE(reset_restarts_delay) {
+    TimerService service(manual_config());
+    int fired = 0;
+    TimerService::TimerId id = service.schedule(10ms, [&fired](int) { ++fired; }, 0);
+    service.advance(6ms);
+    CHECK(service.reset(id));
+    CHECK(service.advance(9ms) == 0u);
+    CHECK(service.advance(1ms) == 1u);
+    CHECK(fired == 1);
+    CHECK(!service.reset(id));
+}
+
+// A repeating timer continues its period from the new expiry
+TEST_CASE(reschedule_repeating_timer_restarts_period) {
+    TimerService service(manual_config());
+    std::vector<std::chrono::steady_clock::duration> fired;
+    std::chrono::steady_clock::time_point start = service.now();
+    TimerService::TimerId id = service.schedule(10ms, [&](int) { fired.push_back(service.now() - start); }, 0, 3);
+    service.advance(10ms);
+    CHECK(service.reschedule(id, 3ms));
+    service.advance(50ms);
+    REQUIRE(fired.size() == 4u);
+    CHECK(fired[0] == 10ms);
+    CHECK(fired[1] == 13ms);
+    CHECK(fired[2] == 23ms);
+    CHECK(fired[3] == 33ms);
+}
+
+// From its own callback, a single shot timer has fired and cannot move; a repeating one moves
+// its next expiry
+TEST_CASE(reschedule_firing_timer) {
+    TimerService service(manual_config());
+    TimerService::TimerId single = 0;
+    TimerService::TimerId repeating = 0;
+    bool single_moved = true;
+    std::vector<std::chrono::steady_clock::duration> fired;
+    std::chrono::steady_clock::time_point start = service.now();
+    single = service.schedule(5ms, [&](int) { single_moved = service.reschedule(single, 1ms); }, 0);
+    repeating = service.schedule(10ms, [&](int) {
+        fired.push_back(service.now() - start);
+        if (fired.size() == 1) {
+            CHECK(service.reschedule(repeating, 25ms));
+        }
+    }, 0, 1);
+    service.advance(100ms);
+    CHECK(!single_moved);
+    REQUIRE(fired.size() == 2u);
+    CHECK(fired[0] == 10ms);
+    CHECK(fired[1] == 35ms);
+    CHECK(service.stats().queue_depth == 0u);
+}
+
+// A lazy cancel only tombstones the timer: it stays queued until it comes due, or until the
+// dead timers outnumber compaction_threshold times the queued ones
+TEST_CASE(lazy_cancel_tombstones_then_compacts) {
+    TimerServiceConfig config = manual_config();
+    config.lazy_cancel = true;
+    config.compaction_threshold = 0.5;
+    TimerService service(config);
+    int fired = 0;
+    std::vector<TimerService::TimerId> ids;
+    for (int i = 0; i < 200; ++i) {
+        ids.push_back(service.schedule(std::chrono::hours(1), [&fired](int) { ++fired; }, i));
+    }
+
+    // 80 of 200 is under the threshold: swept nothing
+    for (int i = 0; i < 80; ++i) {
+        CHECK(service.cancel(ids[i]));
+    }
+    CHECK(!service.cancel(ids[0])); // Already dead
+    service.process_expired(); // A pass of the service, nothing is due
+    TimerServiceStats stats = service.stats();
+    CHECK(stats.tombstones == 80u);
+    CHECK(stats.queue_depth == 200u);
+
+    // 120 of 200: the next pass sweeps them all
+    for (int i = 80; i < 120; ++i) {
+        CHECK(service.cancel(ids[i]));
+    }
+    CHECK(service.stats().tombstones == 120u);
+    service.process_expired(); // A pass of the service, nothing is due
+    stats = service.stats();
+    CHECK(stats.tombstones == 0u);
+    CHECK(stats.queue_depth == 80u);
+
+    CHECK(service.advance(std::chrono::hours(1)) == 80u);
+    CHECK(fired == 80);
+}
+
+// A tombstoned timer coming due is dropped unfired and reclaimed
+TEST_CASE(lazy_cancel_drops_due_tombstones) {
+    TimerServiceConfig config = manual_config();
+    config.lazy_cancel = true;
+    TimerService service(config);
+    int fired = 0;
+    std::vector<TimerService::TimerId> ids;
+    for (int i = 0; i < 10; ++i) {
+        ids.push_back(service.schedule(5ms, [&fired](int) { ++fired; }, i));
+    }
+    for (int i = 0; i < 10; i += 2) {
+        CHECK(service.cancel(ids[i]));
+    }
+    CHECK(service.stats().tombstones == 5u); // Below the minimum compaction size
+    service.advance(5ms);
+    CHECK(fired == 5);
+    TimerServiceStats stats = service.stats();
+    CHECK(stats.tombstones == 0u);
+    CHECK(stats.queue_depth == 0u);
+}
+
+namespace {
+
+// Fires a timer blocking the worker for 50 ms, and two timers of each priority expiring
+// meanwhile in reverse priority order, under a limit of 2 callbacks per 100 ms. Returns the
+// priorities in firing order once count callbacks have run.
+std::vector<TimerPriority> fire_behind_limit(TimerServiceConfig config, size_t count, TimerServiceStats& stats) {
+    config.fire_limit = 2;
+    config.fire_interval = 100ms;
+    config.collect_stats = true;
+    TimerService service(config);
+    std::mutex mutex;
+    std::vector<TimerPriority> order;
+    std::atomic<size_t> fired{0};
+    service.schedule(1ms, [](int) { std::this_thread::sleep_for(50ms); }, 0);
+    for (TimerPriority priority : {TimerPriority::BestEffort, TimerPriority::Normal, TimerPriority::Critical}) {
+        TimerOptions options;
+        options.priority = priority;
+        for (int i = 0; i < 2; ++i) {
+            service.schedule(5ms, [&, priority](int) {
+                std::lock_guard<std::mutex> lock(mutex);
+                order.push_back(priority);
+                fired++;
+            }, i, 0, options);
+        }
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (fired < count && std::chrono::steady_clock::now() - start < 5s) {
+        std::this_thread::sleep_for(1ms);
+    }
+    std::this_thread::sleep_for(250ms); // Nothing else fires
+    stats = service.stats();
+    std::lock_guard<std::mutex> lock(mutex);
+    return order;
+}
+
+} // namespace
+
+// The backlog left by the stall drains at the fire limit, by priority rather than by expiry
+TEST_CASE(fire_limit_serves_backlog_by_priority) {
+    TimerServiceStats stats;
+    std::vector<TimerPriority> order = fire_behind_limit(TimerServiceConfig(), 6, stats);
+    CHECK(order == (std::vector<TimerPriority>{TimerPriority::Critical, TimerPriority::Critical,
+                                               TimerPriority::Normal, TimerPriority::Normal,
+                                               TimerPriority::BestEffort, TimerPriority::BestEffort}));
+    CHECK(stats.max_backlog == 6u);
+    CHECK(stats.backlog == 0u);
+    CHECK(stats.shed == 0u);
+}
+
+// Best effort timers still in the backlog past shed_lateness are dropped unfired
+TEST_CASE(fire_limit_sheds_late_best_effort) {
+    TimerServiceConfig config;
+    config.shed_lateness = 50ms;
+    TimerServiceStats stats;
+    std::vector<TimerPriority> order = fire_behind_limit(config, 4, stats);
+    CHECK(order == (std::vector<TimerPriority>{TimerPriority::Critical, TimerPriority::Critical,
+                                               TimerPriority::Normal, TimerPriority::Normal}));
+    CHECK(stats.shed == 2u);
+    CHECK(stats.backlog == 0u);
+}
+
+namespace {
+
+template<typename T>
+bool ready(const std::future<T>& future) {
+    return future.wait_for(0s) == std::future_status::ready;
+}
+
+} // namespace
+
+// The future carries the result of the callback, its exception, or a broken promise
+TEST_CASE(schedule_future_delivers_outcome) {
+    TimerService service(manual_config());
+    TimerFuture<int> value = service.schedule_future(10ms, [](int x) { return x * 2; }, 21);
+    TimerFuture<void> error = service.schedule_future(10ms, [](int) { throw std::runtime_error("failed"); }, 0);
+    TimerFuture<void> cancelled = service.schedule_future(10ms, [](int) {}, 0);
+    TimerFuture<void> delay = service.schedule_future(20ms);
+
+    CHECK(service.cancel(cancelled.id));
+    service.advance(9ms);
+    CHECK(!ready(value.future));
+    service.advance(1ms);
+    REQUIRE(ready(value.future));
+    CHECK(value.future.get() == 42);
+    bool thrown = false;
+    try {
+        error.future.get();
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    thrown = false;
+    try {
+        cancelled.future.get();
+    } catch (const std::future_error& e) {
+        thrown = e.code() == std::future_errc::broken_promise;
+    }
+    CHECK(thrown);
+    CHECK(!ready(delay.future));
+    service.advance(10ms);
+    CHECK(ready(delay.future));
+}
+
+#ifdef TIMER_SERVICE_COROUTINES
+namespace {
+
+// Coroutine running eagerly, its frame freed once it returns
+struct Eager {
+    struct promise_type {
+        Eager get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+Eager sleeper(TimerService& service, std::chrono::milliseconds delay, std::chrono::steady_clock::time_point& woken) {
+    co_await service.sleep_for(delay);
+    woken = service.now();
+}
+
+// Awaitable of a value, ready after a delay
+struct ValueAfter {
+    TimerService::SleepAwaiter sleep;
+    int value;
+
+    bool await_ready() const noexcept { return sleep.await_ready(); }
+    void await_suspend(std::coroutine_handle<> handle) { sleep.await_suspend(handle); }
+    int await_resume() const noexcept { return value; }
+};
+
+Eager bounded_sleep(TimerService& service, std::chrono::milliseconds delay, std::chrono::milliseconds timeout,
+                    int& outcome) {
+    bool completed = co_await service.with_timeout(service.sleep_for(delay), timeout);
+    outcome = completed ? 1 : 0;
+}
+
+Eager bounded_value(TimerService& service, std::chrono::milliseconds delay, std::chrono::milliseconds timeout,
+                    std::optional<int>& outcome, bool& done) {
+    outcome = co_await service.with_timeout(ValueAfter{service.sleep_for(delay), 7}, timeout);
+    done = true;
+}
+
+} // namespace
+
+// The coroutine resumes from advance_to() at the expiry of its timer
+TEST_CASE(sleep_for_resumes_at_expiry) {
+    TimerService service(manual_config());
+    std::chrono::steady_clock::time_point start = service.now();
+    std::chrono::steady_clock::time_point woken{};
+    sleeper(service, 10ms, woken);
+    service.advance(9ms);
+    CHECK(woken == std::chrono::steady_clock::time_point{});
+    CHECK(service.advance(1ms) == 1u);
+    CHECK(woken == start + 10ms);
+
+    sleeper(service, 0ms, woken); // Does not suspend
+    CHECK(woken == service.now());
+}
+
+// The first of the operation and the timer resumes the coroutine, an operation completing in
+// time cancels the timer
+TEST_CASE(with_timeout_races_operation) {
+    TimerService service(manual_config());
+    int outcome = -1;
+    bounded_sleep(service, 5ms, 10ms, outcome);
+    CHECK(service.advance(5ms) == 1u);
+    CHECK(outcome == 1);
+    CHECK(service.stats().queue_depth == 0u); // Timeout cancelled
+
+    outcome = -1;
+    bounded_sleep(service, 20ms, 10ms, outcome);
+    service.advance(10ms);
+    CHECK(outcome == 0);
+    service.advance(10ms); // The operation completes, its result dropped
+    CHECK(service.stats().queue_depth == 0u);
+
+    std::optional<int> value;
+    bool done = false;
+    bounded_value(service, 5ms, 10ms, value, done);
+    service.advance(5ms);
+    CHECK(done);
+    CHECK(value == 7);
+    done = false;
+    bounded_value(service, 20ms, 10ms, value, done);
+    service.advance(10ms);
+    CHECK(done);
+    CHECK(!value);
+    service.advance(10ms);
+}
+#endif
+
+int main() {
+    return run_tests();
+}
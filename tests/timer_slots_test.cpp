@@ -0,0 +1,71 @@
+#include "timer_slots.h"
+
+#include "test_check.h"
+
+#include <set>
+
+TEST_CASE(slots_released_id_stops_matching) {
+    TimerSlots slots;
+    TimerData data;
+    TimerSlots::Id id = slots.acquire();
+    slots.bind(id, &data);
+    CHECK(slots.live(id));
+    CHECK(slots.find(id) == &data);
+
+    slots.release(id);
+    CHECK(!slots.live(id));
+    CHECK(slots.find(id) == nullptr);
+    CHECK(!slots.kill(id));
+}
+
+TEST_CASE(slots_killed_id_stays_bound_until_released) {
+    TimerSlots slots;
+    TimerData data;
+    TimerSlots::Id id = slots.acquire();
+    slots.bind(id, &data);
+    CHECK(slots.kill(id));
+    CHECK(!slots.live(id));
+    CHECK(slots.dead(id));
+    CHECK(slots.bound(id) == &data);
+    CHECK(!slots.kill(id));
+
+    slots.release(id);
+    CHECK(!slots.dead(id));
+    CHECK(slots.bound(id) == nullptr);
+}
+
+TEST_CASE(slots_id_zero_never_matches) {
+    TimerSlots slots(64);
+    CHECK(!slots.live(0));
+    CHECK(!slots.kill(0));
+}
+
+// One timer scheduled and cancelled at a time reuses the same slot: once its generation is
+// exhausted the slot must be retired rather than hand out its first ids again
+TEST_CASE(slots_stale_id_never_matches_past_generation_wrap) {
+    TimerSlots slots;
+    TimerData data;
+    TimerSlots::Id first = slots.acquire();
+    slots.release(first);
+
+    const uint64_t reuses = uint64_t(1) << TimerSlots::kGenerationBits;
+    std::set<uint32_t> indexes;
+    for (uint64_t i = 0; i < reuses; ++i) {
+        TimerSlots::Id id = slots.acquire();
+        REQUIRE(id != first);
+        indexes.insert(uint32_t(id));
+        slots.release(id);
+    }
+    CHECK(indexes.size() > 1u);
+
+    TimerSlots::Id id = slots.acquire();
+    slots.bind(id, &data);
+    CHECK(!slots.live(first));
+    CHECK(!slots.kill(first));
+    CHECK(slots.find(first) == nullptr);
+    CHECK(slots.live(id));
+}
+
+int main() {
+    return run_tests();
+}
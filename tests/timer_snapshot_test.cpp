@@ -0,0 +1,181 @@
+#include "timer_snapshot.h"
+
+#include "test_check.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+const char* kPath = "timer_snapshot_test.snap";
+
+// Layout offsets of the format, see timer_snapshot.cpp
+constexpr size_t kHeaderSize = 32;
+constexpr size_t kKeysOffset = 16;
+constexpr size_t kFirstKeyLength = kHeaderSize;
+
+std::vector<TimerSnapshotRecord> sample() {
+    std::vector<TimerSnapshotRecord> records(3);
+    auto now = std::chrono::system_clock::now();
+    for (size_t i = 0; i < records.size(); ++i) {
+        TimerSnapshotRecord& record = records[i];
+        record.expiry = now + std::chrono::seconds(i);
+        record.period = std::chrono::milliseconds(100 * i);
+        record.repeat = int(i) - 1;
+        record.slack = std::chrono::milliseconds(i);
+        record.catch_up = i % 2 ? CatchUpPolicy::Skip : CatchUpPolicy::FireAll;
+        record.priority = TimerPriority::BestEffort;
+        record.serial_key = i;
+        record.group = 10 + i;
+        record.key = i == 2 ? "other" : "session.expire";
+        record.payload = std::string(i * 5, char('a' + i));
+    }
+    return records;
+}
+
+std::string read_file(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+void write_file(const char* path, const std::string& data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), std::streamsize(data.size()));
+}
+
+// Whether reading the file throws the documented runtime_error, and nothing else
+bool rejected(const char* path) {
+    try {
+        read_timer_snapshot(path);
+    } catch (const std::runtime_error&) {
+        return true;
+    } catch (...) {
+        return false;
+    }
+    return false;
+}
+
+template<typename T>
+void patch(std::string& data, size_t offset, T value) {
+    std::memcpy(&data[offset], &value, sizeof(value));
+}
+
+} // namespace
+
+TEST_CASE(snapshot_round_trip) {
+    std::vector<TimerSnapshotRecord> records = sample();
+    write_timer_snapshot(kPath, records);
+    std::vector<TimerSnapshotRecord> read = read_timer_snapshot(kPath);
+    REQUIRE(read.size() == records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        CHECK(read[i].expiry == std::chrono::time_point_cast<std::chrono::nanoseconds>(records[i].expiry));
+        CHECK(read[i].period == records[i].period);
+        CHECK(read[i].repeat == records[i].repeat);
+        CHECK(read[i].slack == records[i].slack);
+        CHECK(read[i].catch_up == records[i].catch_up);
+        CHECK(read[i].priority == records[i].priority);
+        CHECK(read[i].serial_key == records[i].serial_key);
+        CHECK(read[i].group == records[i].group);
+        CHECK(read[i].key == records[i].key);
+        CHECK(read[i].payload == records[i].payload);
+    }
+    std::remove(kPath);
+}
+
+TEST_CASE(snapshot_empty_round_trip) {
+    write_timer_snapshot(kPath, {});
+    CHECK(read_timer_snapshot(kPath).empty());
+    std::remove(kPath);
+}
+
+TEST_CASE(snapshot_truncated_files_rejected) {
+    write_timer_snapshot(kPath, sample());
+    std::string data = read_file(kPath);
+    for (size_t size = 0; size < data.size(); ++size) {
+        write_file(kPath, data.substr(0, size));
+        CHECK(rejected(kPath));
+    }
+    std::remove(kPath);
+}
+
+TEST_CASE(snapshot_missing_file_rejected) {
+    std::remove(kPath);
+    CHECK(rejected(kPath));
+}
+
+TEST_CASE(snapshot_corrupt_headers_rejected) {
+    write_timer_snapshot(kPath, sample());
+    const std::string data = read_file(kPath);
+
+    std::string bad_magic = data;
+    bad_magic[0] = 'X';
+    write_file(kPath, bad_magic);
+    CHECK(rejected(kPath));
+
+    std::string bad_version = data;
+    patch(bad_version, 8, uint32_t(99));
+    write_file(kPath, bad_version);
+    CHECK(rejected(kPath));
+
+    std::string swapped = data;
+    patch(swapped, 12, uint32_t(0x04030201));
+    write_file(kPath, swapped);
+    CHECK(rejected(kPath));
+
+    std::string many_keys = data;
+    patch(many_keys, kKeysOffset, UINT64_MAX);
+    write_file(kPath, many_keys);
+    CHECK(rejected(kPath));
+
+    std::string many_records = data;
+    patch(many_records, kKeysOffset + 8, uint64_t(1) << 40);
+    write_file(kPath, many_records);
+    CHECK(rejected(kPath));
+    std::remove(kPath);
+}
+
+// Lengths whose padding wraps past SIZE_MAX must not slip through the bounds check
+TEST_CASE(snapshot_corrupt_lengths_rejected) {
+    write_timer_snapshot(kPath, sample());
+    const std::string data = read_file(kPath);
+    for (uint64_t length : {UINT64_MAX, UINT64_MAX - 3, UINT64_MAX - 7, uint64_t(data.size())}) {
+        std::string corrupt = data;
+        patch(corrupt, kFirstKeyLength, length);
+        write_file(kPath, corrupt);
+        CHECK(rejected(kPath));
+    }
+    std::remove(kPath);
+}
+
+TEST_CASE(snapshot_corrupt_bytes_never_crash) {
+    // Every single byte flipped either reads back or is rejected, never anything else
+    write_timer_snapshot(kPath, sample());
+    const std::string data = read_file(kPath);
+    for (size_t offset = 0; offset < data.size(); ++offset) {
+        std::string corrupt = data;
+        corrupt[offset] = char(~corrupt[offset]);
+        write_file(kPath, corrupt);
+        try {
+            read_timer_snapshot(kPath);
+        } catch (const std::runtime_error&) {
+        } catch (...) {
+            CHECK(!"unexpected exception type");
+        }
+    }
+    std::remove(kPath);
+}
+
+TEST_CASE(snapshot_replaces_previous_file) {
+    write_timer_snapshot(kPath, sample());
+    write_timer_snapshot(kPath, {});
+    CHECK(read_timer_snapshot(kPath).empty());
+    std::ifstream temporary(std::string(kPath) + ".tmp");
+    CHECK(!temporary);
+    std::remove(kPath);
+}
+
+int main() {
+    return run_tests();
+}
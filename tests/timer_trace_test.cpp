@@ -0,0 +1,62 @@
+#include "timer_trace.h"
+
+#include "test_check.h"
+
+#include <sstream>
+#include <thread>
+
+namespace {
+
+size_t exported(uint64_t timer = 0) {
+    std::ostringstream out;
+    return TimerTrace::write_chrome_trace(out, timer);
+}
+
+} // namespace
+
+TEST_CASE(trace_records_and_filters) {
+    TimerTrace::clear();
+    TimerTrace::record(TimerEvent::Schedule, 1, 1000);
+    TimerTrace::record(TimerEvent::FireBegin, 1, 5);
+    TimerTrace::record(TimerEvent::FireEnd, 1);
+    TimerTrace::record(TimerEvent::Cancel, 2);
+    CHECK(exported() == 4u);
+    CHECK(exported(1) == 3u);
+    CHECK(exported(3) == 0u);
+    TimerTrace::clear();
+    CHECK(exported() == 0u);
+}
+
+TEST_CASE(trace_sampling_keeps_whole_timers) {
+    TimerTrace::set_sampling(0.0);
+    CHECK(!TimerTrace::sampled(42));
+    TimerTrace::set_sampling(0.5);
+    size_t sampled = 0;
+    for (uint64_t timer = 1; timer <= 10000; ++timer) {
+        sampled += TimerTrace::sampled(timer) ? 1 : 0;
+        CHECK(TimerTrace::sampled(timer) == TimerTrace::sampled(timer));
+    }
+    CHECK(sampled > 4000 && sampled < 6000);
+    TimerTrace::set_sampling(1.0);
+    CHECK(TimerTrace::sampled(42));
+}
+
+// Threads that record and exit hand their ring over: churn must not grow the rings
+TEST_CASE(trace_rings_recycled_after_thread_exit) {
+    auto record = [] { TimerTrace::record(TimerEvent::Schedule, 7, 0); };
+    std::thread(record).join();
+    size_t bytes = TimerTrace::memory_usage();
+    for (int i = 0; i < 200; ++i) {
+        std::thread(record).join();
+    }
+    CHECK(TimerTrace::memory_usage() == bytes);
+
+    // The ring of the last thread is still exported
+    TimerTrace::clear();
+    std::thread([] { TimerTrace::record(TimerEvent::Cancel, 9); }).join();
+    CHECK(exported(9) == 1u);
+}
+
+int main() {
+    return run_tests();
+}
@@ -0,0 +1,128 @@
+#include "wheel_timer_queue.h"
+
+#include "test_check.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+using TimePoint = std::chrono::steady_clock::time_point;
+
+const TimePoint origin = TimePoint(std::chrono::hours(1));
+
+// Expired timers in pop order
+std::vector<TimerData*> pop_all(WheelTimerQueue& queue, TimePoint now) {
+    std::vector<TimerData*> popped;
+    TimePoint expiry;
+    while (TimerData* data = queue.pop_expired(now, expiry)) {
+        popped.push_back(data);
+    }
+    return popped;
+}
+
+} // namespace
+
+// 8 slots per level and 2 levels: 64 ticks before the overflow list. Timers at every level
+// and in the overflow fire on their tick, never before it.
+TEST_CASE(wheel_expires_across_levels_and_overflow) {
+    WheelTimerQueue queue(1ms, 2, 3, 0, origin);
+    const std::vector<std::chrono::milliseconds> delays{3ms, 9ms, 40ms, 63ms, 64ms, 200ms, 1000ms};
+    std::map<TimerData*, std::chrono::milliseconds> timers;
+    for (auto it = delays.rbegin(); it != delays.rend(); ++it) {
+        timers[queue.push(origin + *it, TimerData())] = *it;
+    }
+
+    for (std::chrono::milliseconds delay : delays) {
+        CHECK(queue.next_expiry() <= origin + delay);
+        CHECK(pop_all(queue, origin + delay - 1ms).empty());
+        std::vector<TimerData*> popped = pop_all(queue, origin + delay);
+        REQUIRE(popped.size() == 1u);
+        CHECK(timers[popped[0]] == delay);
+        CHECK(queue.expiry(popped[0]) == origin + delay);
+        queue.release(popped[0]);
+    }
+    CHECK(queue.empty());
+}
+
+// Cancelling the timer the wheel would wake up for moves the next expiry to the next timer
+TEST_CASE(wheel_next_expiry_follows_erase) {
+    WheelTimerQueue queue(1ms, 2, 3, 0, origin);
+    TimerData* first = queue.push(origin + 5ms, TimerData());
+    queue.push(origin + 30ms, TimerData());
+    CHECK(queue.next_expiry() == origin + 5ms);
+    queue.erase(first);
+    CHECK(queue.next_expiry() > origin + 5ms);
+    CHECK(queue.next_expiry() <= origin + 30ms);
+    CHECK(pop_all(queue, origin + 29ms).empty());
+    std::vector<TimerData*> popped = pop_all(queue, origin + 30ms);
+    REQUIRE(popped.size() == 1u);
+    queue.release(popped[0]);
+}
+
+// Random pushes, erases and repositions across the levels and the overflow, checked against
+// the tick every timer is due on
+TEST_CASE(wheel_matches_reference) {
+    const auto tick = 1ms;
+    WheelTimerQueue queue(tick, 3, 3, 0, origin);
+    std::map<TimerData*, TimePoint> due; // Tick every armed timer fires on
+    std::vector<TimerData*> armed;
+    std::mt19937 rng(11);
+    TimePoint now = origin;
+    auto due_tick = [&](TimePoint expiry) {
+        return expiry <= origin ? origin : origin + (expiry - origin + tick - 1ns) / tick * tick;
+    };
+    auto random_expiry = [&] { return now + std::chrono::microseconds(rng() % 3000000); };
+
+    for (int step = 0; step < 20000; ++step) {
+        unsigned action = rng() % 8;
+        if (action < 4 || armed.empty()) {
+            TimePoint expiry = random_expiry();
+            TimerData* data = queue.push(expiry, TimerData());
+            due[data] = due_tick(expiry);
+            armed.push_back(data);
+        } else if (action < 5) {
+            size_t index = rng() % armed.size();
+            TimerData* data = armed[index];
+            armed[index] = armed.back();
+            armed.pop_back();
+            due.erase(data);
+            queue.erase(data);
+        } else if (action < 6) {
+            TimerData* data = armed[rng() % armed.size()];
+            TimePoint expiry = random_expiry();
+            queue.reposition(data, expiry);
+            due[data] = due_tick(expiry);
+        } else {
+            now += std::chrono::microseconds(rng() % 20000);
+            for (TimerData* data : pop_all(queue, now)) {
+                REQUIRE(due.count(data) == 1u);
+                CHECK(due[data] <= now);
+                due.erase(data);
+                armed.erase(std::find(armed.begin(), armed.end(), data));
+                queue.release(data);
+            }
+            for (const auto& timer : due) {
+                REQUIRE(timer.second > now); // Everything due was popped
+            }
+        }
+
+        REQUIRE(queue.size() == due.size());
+        if (!due.empty()) {
+            // Never later than the first timer, or the worker oversleeps
+            TimePoint first = TimePoint::max();
+            for (const auto& timer : due) {
+                first = std::min(first, timer.second);
+            }
+            CHECK(queue.next_expiry() <= std::max(first, now));
+        }
+    }
+}
+
+int main() {
+    return run_tests();
+}
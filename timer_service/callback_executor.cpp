@@ -0,0 +1,145 @@
+#include "callback_executor.h"
+#include "timer_trace.h"
+
+#include <algorithm>
+
+CallbackExecutor::CallbackExecutor(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back(new Worker);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers_[i]->thread = std::thread(&CallbackExecutor::run_, this, i);
+    }
+}
+
+CallbackExecutor::~CallbackExecutor() {
+    stop();
+}
+
+void CallbackExecutor::stop(bool drain) {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        draining_ = drain; // Set first, a thread that sees stopping_ sees it too
+        stopping_ = true;
+    }
+#ifdef __cpp_lib_atomic_wait
+    wake_epoch_.fetch_add(1);
+    wake_epoch_.notify_all();
+#else
+    wake_cv_.notify_all();
+#endif
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    if (!drain) {
+        // Destroyed without running, nothing takes tasks anymore
+        for (auto& worker : workers_) {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            shared_count_ -= worker->shared.size();
+            pending_ -= worker->shared.size() + worker->pinned.size();
+            worker->shared.clear();
+            worker->pinned.clear();
+            worker->pinned_count = 0;
+        }
+    }
+}
+
+void CallbackExecutor::submit(Task&& task, uint64_t serial_key) {
+    bool pinned = serial_key != 0;
+    Worker& worker = *workers_[pinned ? serial_key % workers_.size()
+                                      : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+    // Counted before the task is published, a thread taking it at once must not decrement first
+    pending_++;
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (pinned) {
+            worker.pinned.push_back(std::move(task));
+            worker.pinned_count++;
+        } else {
+            worker.shared.push_back(std::move(task));
+            shared_count_++;
+        }
+    }
+
+#ifdef __cpp_lib_atomic_wait
+    // An idle thread reads the epoch before looking for work: bumped after the count update,
+    // either the thread finds the task or its wait returns. No lock is taken, and notifying
+    // while no thread waits stays in user space.
+    wake_epoch_.fetch_add(1);
+    if (pinned) {
+        // Only the owner can run it, and all threads wait on the same epoch
+        wake_epoch_.notify_all();
+    } else {
+        wake_epoch_.notify_one();
+    }
+#else
+    // Taking wake_mutex_ orders the count update before a sleeping thread re-checks it
+    { std::lock_guard<std::mutex> lock(wake_mutex_); }
+    if (pinned) {
+        // Only the owner can run it, and all threads share the condition variable
+        wake_cv_.notify_all();
+    } else {
+        wake_cv_.notify_one();
+    }
+#endif
+}
+
+bool CallbackExecutor::take_(size_t index, Task& task) {
+    Worker& self = *workers_[index];
+    {
+        std::lock_guard<std::mutex> lock(self.mutex);
+        if (!self.pinned.empty()) {
+            task = std::move(self.pinned.front());
+            self.pinned.pop_front();
+            self.pinned_count--;
+            return true;
+        }
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.shared.empty()) {
+            task = std::move(victim.shared.front());
+            victim.shared.pop_front();
+            shared_count_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CallbackExecutor::run_(size_t index) {
+    TIMER_SERVICE_TRACE_THREAD("timer executor " + std::to_string(index));
+    Task task;
+    while (true) {
+#ifdef __cpp_lib_atomic_wait
+        uint32_t epoch = wake_epoch_.load();
+#endif
+        if (stopping_ && !draining_) {
+            return; // Queued tasks are dropped, not run
+        }
+        if (take_(index, task)) {
+            pending_--;
+            task();
+            task.reset();
+            continue;
+        }
+#ifdef __cpp_lib_atomic_wait
+        if (stopping_ && (!draining_ || !has_work_(index))) {
+            return;
+        }
+        if (!has_work_(index)) {
+            wake_epoch_.wait(epoch); // Returns at once if a task came in since the epoch was read
+        }
+#else
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_cv_.wait(lock, [this, index] { return stopping_ || has_work_(index); });
+        if (stopping_ && (!draining_ || !has_work_(index))) {
+            return;
+        }
+#endif
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "inplace_callback.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing pool of threads running timer callbacks away from the timing thread.
+ *
+ * Every thread owns a queue of stealable tasks and a queue of pinned ones. Tasks without a
+ * serial key are spread round robin and idle threads steal them from busy ones. Tasks that
+ * share a serial key are pinned to the same thread, so they run in submission order and
+ * never concurrently.
+ */
+class CallbackExecutor {
+public:
+    using Task = InplaceCallback<4 * sizeof(void*)>;
+
+    /**
+     * @param threads Number of threads, at least one
+     */
+    explicit CallbackExecutor(size_t threads);
+
+    /**
+     * Stop the threads once their current task is done, queued tasks are destroyed without
+     * running
+     */
+    ~CallbackExecutor();
+
+    /**
+     * Stop the threads and join them, see the destructor. Idempotent.
+     *
+     * @param drain Run the queued tasks before stopping rather than dropping them
+     */
+    void stop(bool drain = false);
+
+    CallbackExecutor(const CallbackExecutor&) = delete;
+    CallbackExecutor& operator=(const CallbackExecutor&) = delete;
+
+    /**
+     * Queue a task.
+     *
+     * @param task Task to run
+     * @param serial_key 0 for a task free to run anywhere, tasks with the same non zero key are serialised
+     */
+    void submit(Task&& task, uint64_t serial_key = 0);
+
+    /**
+     * Number of tasks queued and not started yet
+     */
+    size_t pending() const { return pending_.load(std::memory_order_relaxed); }
+
+    size_t threads() const { return workers_.size(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> shared;      // Stealable by every thread
+        std::deque<Task> pinned;      // Serial tasks, run by this thread only
+        std::atomic<size_t> pinned_count{0};
+        std::thread thread;
+    };
+
+    void run_(size_t index);
+
+    /**
+     * Take the next task for the thread at index: its pinned tasks, then its own shared
+     * tasks, then tasks stolen from the other threads
+     */
+    bool take_(size_t index, Task& task);
+
+    bool has_work_(size_t index) const {
+        return shared_count_.load() > 0 || workers_[index]->pinned_count.load() > 0;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // Idle threads wait on wake_epoch_ where std::atomic::wait is available, on wake_cv_
+    // otherwise. Both are always declared so that the layout does not depend on the standard.
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<uint32_t> wake_epoch_{0}; // Bumped by every submission and by stop()
+    std::atomic<size_t> shared_count_{0};
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> next_{0};
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> draining_{false}; // Threads stop only once out of work
+};
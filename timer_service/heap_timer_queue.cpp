@@ -0,0 +1,75 @@
+#include "heap_timer_queue.h"
+
+constexpr uint32_t HeapTimerQueue::kDetached;
+
+HeapTimerQueue::HeapTimerQueue(size_t expected_timers) : heap_(SlotPosition{&slots_}) {
+    heap_.reserve(expected_timers);
+    free_slots_.reserve(expected_timers);
+    slots_.resize(expected_timers);
+    for (size_t i = expected_timers; i-- > 0;) {
+        slots_[i].index = uint32_t(i);
+        free_slots_.push_back(uint32_t(i));
+    }
+}
+
+TimerData* HeapTimerQueue::push(TimePoint expiry, TimerData&& data) {
+    if (free_slots_.empty()) {
+        slots_.emplace_back();
+        slots_.back().index = uint32_t(slots_.size() - 1);
+        free_slots_.push_back(slots_.back().index);
+    }
+    Slot& slot = slots_[free_slots_.back()];
+    free_slots_.pop_back();
+    static_cast<TimerData&>(slot) = std::move(data);
+    heap_.push(Key{expiry + slot.slack, slot.index});
+    return &slot;
+}
+
+void HeapTimerQueue::erase(TimerData* data) {
+    Slot* slot = static_cast<Slot*>(data);
+    remove_(slot->heap_pos);
+    release(slot);
+}
+
+void HeapTimerQueue::reposition(TimerData* data, TimePoint expiry) {
+    Slot* slot = static_cast<Slot*>(data);
+    heap_.update(slot->heap_pos, expiry + slot->slack);
+}
+
+HeapTimerQueue::TimePoint HeapTimerQueue::expiry(const TimerData* data) const {
+    const Slot* slot = static_cast<const Slot*>(data);
+    return heap_[slot->heap_pos].key - slot->slack;
+}
+
+TimerData* HeapTimerQueue::pop_expired(TimePoint now, TimePoint& expiry) {
+    if (heap_.empty()) {
+        return nullptr;
+    }
+    Slot& slot = slots_[heap_.front().slot];
+    if (heap_.front().key - slot.slack > now) {
+        return nullptr;
+    }
+    expiry = heap_.front().key - slot.slack;
+    remove_(0);
+    return &slot;
+}
+
+void HeapTimerQueue::rearm(TimerData* data, TimePoint expiry) {
+    heap_.push(Key{expiry + data->slack, static_cast<Slot*>(data)->index});
+}
+
+void HeapTimerQueue::release(TimerData* data) {
+    Slot* slot = static_cast<Slot*>(data);
+    // Destroy the callback and its argument now, the slot itself stays for reuse
+    static_cast<TimerData&>(*slot) = TimerData{};
+    slot->heap_pos = kDetached;
+    free_slots_.push_back(slot->index);
+}
+
+size_t HeapTimerQueue::memory_usage() const {
+    return heap_.memory_usage() + slots_.size() * sizeof(Slot) + free_slots_.capacity() * sizeof(uint32_t);
+}
+
+void HeapTimerQueue::remove_(uint32_t pos) {
+    slots_[heap_.remove(pos)].heap_pos = kDetached;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "indexed_heap.h"
+#include "timer_queue.h"
+
+#include <deque>
+#include <vector>
+
+/**
+ * Timer queue backed by a 4-ary min-heap in contiguous storage, timers fire at their exact expiry.
+ *
+ * The heap only holds {expiry + slack, slot} keys, 16 bytes each, so sifting walks a flat array
+ * instead of chasing tree nodes. Timers live in a slab of slots that never move, every slot
+ * remembers its heap position for indexed removal and repositioning. Expiries are served like
+ * the tree backend: ordered by the point they must be served by, popped once their expiry passed.
+ */
+class HeapTimerQueue : public TimerQueue {
+public:
+    /**
+     * @param expected_timers Number of timers to reserve heap keys and slots for
+     */
+    explicit HeapTimerQueue(size_t expected_timers = 0);
+
+    HeapTimerQueue(const HeapTimerQueue&) = delete;
+    HeapTimerQueue& operator=(const HeapTimerQueue&) = delete;
+
+    TimerData* push(TimePoint expiry, TimerData&& data) override;
+    void erase(TimerData* data) override;
+    void reposition(TimerData* data, TimePoint expiry) override;
+    TimePoint expiry(const TimerData* data) const override;
+    bool empty() const override { return heap_.empty(); }
+    size_t size() const override { return heap_.size(); }
+    TimePoint next_expiry() const override { return heap_.front().key; }
+    TimerData* pop_expired(TimePoint now, TimePoint& expiry) override;
+    void rearm(TimerData* data, TimePoint expiry) override;
+    void release(TimerData* data) override;
+    size_t memory_usage() const override;
+
+private:
+    static constexpr uint32_t kDetached = UINT32_MAX;
+
+    struct Key {
+        TimePoint key; // expiry + slack
+        uint32_t slot;
+    };
+
+    struct Slot : TimerData {
+        uint32_t index = 0;            // Position in slots_
+        uint32_t heap_pos = kDetached; // Position in heap_, kDetached while popped or free
+    };
+
+    struct SlotPosition {
+        std::deque<Slot>* slots;
+        uint32_t& operator()(uint32_t slot) const { return (*slots)[slot].heap_pos; }
+    };
+
+    void remove_(uint32_t pos);
+
+    std::deque<Slot> slots_; // Slab, a deque so that slots never move when it grows
+    IndexedHeap<Key, SlotPosition> heap_;
+    std::vector<uint32_t> free_slots_;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * d-ary min-heap of small keys in contiguous storage, each tracking the position of its entry
+ * for indexed removal and repositioning. Shared by HeapTimerQueue and TypedTimerService.
+ *
+ * The heap holds keys only, the entries they refer to live elsewhere and are addressed by a
+ * slot number. Every move of a key is reported through Position, so that an entry always
+ * knows where its key sits.
+ *
+ * @tparam Key Copyable key with a `key` member ordered by operator< and a uint32_t `slot`
+ * @tparam Position Callable as position(slot), returning a uint32_t& to the heap position of the entry
+ * @tparam Arity Children per node, 4 keeps the children of a node within a cache line
+ */
+template<typename Key, typename Position, size_t Arity = 4>
+class IndexedHeap {
+public:
+    explicit IndexedHeap(Position position) : position_(position) {}
+
+    void reserve(size_t keys) { heap_.reserve(keys); }
+    bool empty() const { return heap_.empty(); }
+    size_t size() const { return heap_.size(); }
+    const Key& front() const { return heap_.front(); }
+    const Key& operator[](uint32_t pos) const { return heap_[pos]; }
+
+    /**
+     * Bytes allocated for keys, free capacity included
+     */
+    size_t memory_usage() const { return heap_.capacity() * sizeof(Key); }
+
+    void push(const Key& key) {
+        heap_.push_back(key);
+        sift_up_(uint32_t(heap_.size() - 1));
+    }
+
+    /**
+     * Remove the key at a position, the position of its entry is left for the caller to reset
+     *
+     * @return slot of the removed key
+     */
+    uint32_t remove(uint32_t pos) {
+        uint32_t slot = heap_[pos].slot;
+        Key last = heap_.back();
+        heap_.pop_back();
+        if (pos != heap_.size()) {
+            replace_(pos, last);
+        }
+        return slot;
+    }
+
+    /**
+     * Change the key at a position, moving it up or down as needed
+     */
+    template<typename Value>
+    void update(uint32_t pos, const Value& value) {
+        Key key = heap_[pos];
+        key.key = value;
+        replace_(pos, key);
+    }
+
+private:
+    void replace_(uint32_t pos, const Key& key) {
+        bool up = key.key < heap_[pos].key;
+        place_(pos, key);
+        if (up) {
+            sift_up_(pos);
+        } else {
+            sift_down_(pos);
+        }
+    }
+
+    void sift_up_(uint32_t pos) {
+        Key key = heap_[pos];
+        while (pos > 0) {
+            uint32_t parent = uint32_t((pos - 1) / Arity);
+            if (!(key.key < heap_[parent].key)) {
+                break;
+            }
+            place_(pos, heap_[parent]);
+            pos = parent;
+        }
+        place_(pos, key);
+    }
+
+    void sift_down_(uint32_t pos) {
+        Key key = heap_[pos];
+        size_t size = heap_.size();
+        for (;;) {
+            size_t first = size_t(pos) * Arity + 1;
+            if (first >= size) {
+                break;
+            }
+            size_t last = std::min(first + Arity, size);
+            size_t min = first;
+            for (size_t child = first + 1; child < last; ++child) {
+                if (heap_[child].key < heap_[min].key) {
+                    min = child;
+                }
+            }
+            if (!(heap_[min].key < key.key)) {
+                break;
+            }
+            place_(pos, heap_[min]);
+            pos = uint32_t(min);
+        }
+        place_(pos, key);
+    }
+
+    void place_(uint32_t pos, const Key& key) {
+        heap_[pos] = key;
+        position_(key.slot) = pos;
+    }
+
+    std::vector<Key> heap_;
+    Position position_;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Move-only, type-erased void() callable with an inline buffer.
+ *
+ * Callables that fit in Size bytes (and Align alignment) and are nothrow movable are
+ * constructed in place, anything larger is moved to the heap. Unlike std::function the
+ * wrapped callable does not have to be copyable.
+ */
+template<size_t Size, size_t Align = alignof(std::max_align_t)>
+class InplaceCallback {
+public:
+    static constexpr size_t buffer_size = Size;
+
+    /**
+     * Whether a callable of type F is stored without a heap allocation
+     */
+    template<typename F>
+    static constexpr bool fits_inline() {
+        return sizeof(F) <= Size && alignof(F) <= Align && std::is_nothrow_move_constructible<F>::value;
+    }
+
+    InplaceCallback() noexcept = default;
+
+    template<typename F,
+             typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InplaceCallback>::value>::type>
+    InplaceCallback(F&& f) {
+        using Fn = typename std::decay<F>::type;
+        emplace_<Fn>(std::forward<F>(f), std::integral_constant<bool, fits_inline<Fn>()>());
+    }
+
+    InplaceCallback(InplaceCallback&& other) noexcept {
+        move_from_(other);
+    }
+
+    InplaceCallback& operator=(InplaceCallback&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from_(other);
+        }
+        return *this;
+    }
+
+    InplaceCallback(const InplaceCallback&) = delete;
+    InplaceCallback& operator=(const InplaceCallback&) = delete;
+
+    ~InplaceCallback() {
+        reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const noexcept {
+        return ops_ != nullptr;
+    }
+
+    /**
+     * Bytes the wrapped callable occupies on the heap, 0 when stored inline
+     */
+    size_t heap_size() const noexcept {
+        return ops_ ? ops_->heap_size : 0;
+    }
+
+    void reset() noexcept {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src) noexcept; // Move constructs dst from src and destroys src
+        void (*destroy)(void* storage) noexcept;
+        size_t heap_size;
+    };
+
+    template<typename F>
+    struct InlineModel {
+        static void invoke(void* storage) { (*static_cast<F*>(storage))(); }
+        static void move(void* dst, void* src) noexcept {
+            ::new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* storage) noexcept { static_cast<F*>(storage)->~F(); }
+        static const Ops ops;
+    };
+
+    template<typename F>
+    struct HeapModel {
+        static F*& get(void* storage) { return *static_cast<F**>(storage); }
+        static void invoke(void* storage) { (*get(storage))(); }
+        static void move(void* dst, void* src) noexcept { ::new (dst) F*(get(src)); }
+        static void destroy(void* storage) noexcept { delete get(storage); }
+        static const Ops ops;
+    };
+
+    template<typename Fn, typename F>
+    void emplace_(F&& f, std::true_type /*inline*/) {
+        ::new (static_cast<void*>(storage_)) Fn(std::forward<F>(f));
+        ops_ = &InlineModel<Fn>::ops;
+    }
+
+    template<typename Fn, typename F>
+    void emplace_(F&& f, std::false_type /*inline*/) {
+        ::new (static_cast<void*>(storage_)) Fn*(new Fn(std::forward<F>(f)));
+        ops_ = &HeapModel<Fn>::ops;
+    }
+
+    void move_from_(InplaceCallback& other) noexcept {
+        if (other.ops_) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    static_assert(Size >= sizeof(void*), "InplaceCallback buffer must at least hold a pointer");
+
+    alignas(Align) unsigned char storage_[Size];
+    const Ops* ops_ = nullptr;
+};
+
+template<size_t Size, size_t Align>
+template<typename F>
+const typename InplaceCallback<Size, Align>::Ops InplaceCallback<Size, Align>::InlineModel<F>::ops = {
+    &InplaceCallback<Size, Align>::InlineModel<F>::invoke,
+    &InplaceCallback<Size, Align>::InlineModel<F>::move,
+    &InplaceCallback<Size, Align>::InlineModel<F>::destroy,
+    0,
+};
+
+template<size_t Size, size_t Align>
+template<typename F>
+const typename InplaceCallback<Size, Align>::Ops InplaceCallback<Size, Align>::HeapModel<F>::ops = {
+    &InplaceCallback<Size, Align>::HeapModel<F>::invoke,
+    &InplaceCallback<Size, Align>::HeapModel<F>::move,
+    &InplaceCallback<Size, Align>::HeapModel<F>::destroy,
+    sizeof(F),
+};
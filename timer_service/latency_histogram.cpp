@@ -0,0 +1,92 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+
+constexpr unsigned LatencyHistogram::kSubBucketBits;
+constexpr size_t LatencyHistogram::kBuckets;
+
+namespace {
+
+constexpr uint64_t kExact = uint64_t(1) << (LatencyHistogram::kSubBucketBits + 1);
+constexpr uint64_t kSubBuckets = uint64_t(1) << LatencyHistogram::kSubBucketBits;
+
+unsigned log2(uint64_t value) {
+    return 63 - unsigned(__builtin_clzll(value));
+}
+
+} // namespace
+
+std::chrono::nanoseconds HistogramSnapshot::mean() const {
+    return std::chrono::nanoseconds(count_ == 0 ? 0 : sum_ / count_);
+}
+
+std::chrono::nanoseconds HistogramSnapshot::percentile(double percentile) const {
+    if (count_ == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    uint64_t rank = uint64_t(std::max(1.0, percentile / 100.0 * double(count_) + 0.5));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < counts_.size(); ++bucket) {
+        seen += counts_[bucket];
+        if (seen >= rank) {
+            return std::chrono::nanoseconds(std::min(LatencyHistogram::bucket_max(bucket), max_));
+        }
+    }
+    return max();
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other) {
+    if (counts_.size() < other.counts_.size()) {
+        counts_.resize(other.counts_.size());
+    }
+    for (size_t bucket = 0; bucket < other.counts_.size(); ++bucket) {
+        counts_[bucket] += other.counts_[bucket];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+}
+
+LatencyHistogram::LatencyHistogram() : sum_(0), max_(0) {
+    for (auto& count : counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::bucket_(uint64_t value) {
+    if (value < kExact) {
+        return size_t(value);
+    }
+    unsigned shift = log2(value) - kSubBucketBits;
+    return size_t(kExact + (shift - 1) * kSubBuckets + ((value >> shift) - kSubBuckets));
+}
+
+uint64_t LatencyHistogram::bucket_max(size_t bucket) {
+    if (bucket < kExact) {
+        return bucket;
+    }
+    uint64_t shift = (bucket - kExact) / kSubBuckets + 1;
+    uint64_t sub = (bucket - kExact) % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds value) noexcept {
+    uint64_t ns = value.count() < 0 ? 0 : uint64_t(value.count());
+    counts_[bucket_(ns)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const {
+    HistogramSnapshot snapshot;
+    snapshot.counts_.resize(kBuckets);
+    for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+        snapshot.counts_[bucket] = counts_[bucket].load(std::memory_order_relaxed);
+        snapshot.count_ += snapshot.counts_[bucket];
+    }
+    snapshot.sum_ = sum_.load(std::memory_order_relaxed);
+    snapshot.max_ = max_.load(std::memory_order_relaxed);
+    return snapshot;
+}
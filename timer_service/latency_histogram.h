@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Copy of a LatencyHistogram at one point in time, queried for percentiles.
+ */
+class HistogramSnapshot {
+public:
+    uint64_t count() const { return count_; }
+    std::chrono::nanoseconds max() const { return std::chrono::nanoseconds(max_); }
+    std::chrono::nanoseconds mean() const;
+
+    /**
+     * Smallest recorded value that the given share of the values did not exceed, to the
+     * precision of the histogram buckets.
+     *
+     * @param percentile Between 0 and 100
+     */
+    std::chrono::nanoseconds percentile(double percentile) const;
+
+    /**
+     * Add the values of another snapshot, e.g. to aggregate the shards of a service
+     */
+    void merge(const HistogramSnapshot& other);
+
+private:
+    friend class LatencyHistogram;
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+/**
+ * Log-linear histogram of durations in the spirit of HdrHistogram.
+ *
+ * Values below 64 ns are counted exactly, larger ones in buckets of 32 per power of two,
+ * so every value is known within ~3% over the whole 64-bit nanosecond range. The buckets are
+ * relaxed atomics: record() is wait-free and can be called from any thread.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 5;
+    static constexpr size_t kBuckets = (size_t(1) << (kSubBucketBits + 1)) +
+                                       (63 - kSubBucketBits) * (size_t(1) << kSubBucketBits);
+
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    /**
+     * @param value Recorded duration, negative values count as 0
+     */
+    void record(std::chrono::nanoseconds value) noexcept;
+
+    HistogramSnapshot snapshot() const;
+
+    /**
+     * Highest value counted in a bucket
+     */
+    static uint64_t bucket_max(size_t bucket);
+
+private:
+    static size_t bucket_(uint64_t value);
+
+    std::atomic<uint64_t> counts_[kBuckets];
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
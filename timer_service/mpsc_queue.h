@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Bounded lock-free multi-producer single-consumer queue (Vyukov's array queue).
+ *
+ * Producers claim a cell with a single compare-and-swap on the enqueue position and publish
+ * it with a release store, the consumer never blocks them. Elements are moved in and out of
+ * preallocated cells, there is no allocation after construction. try_pop() must only be
+ * called by one thread at a time.
+ */
+template<typename T>
+class BoundedMpscQueue {
+public:
+    /**
+     * @param capacity Number of cells, rounded up to a power of two
+     */
+    explicit BoundedMpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_ = new Cell[size];
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~BoundedMpscQueue() {
+        T item;
+        while (try_pop(item)) {
+        }
+        delete[] cells_;
+    }
+
+    BoundedMpscQueue(const BoundedMpscQueue&) = delete;
+    BoundedMpscQueue& operator=(const BoundedMpscQueue&) = delete;
+
+    /**
+     * Append an element, from any thread.
+     *
+     * @return false if the queue is full, item is left untouched
+     */
+    bool try_push(T&& item) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        ::new (static_cast<void*>(&cell->storage)) T(std::move(item));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Take the oldest published element, from the single consumer.
+     *
+     * @return false if no element is published
+     */
+    bool try_pop(T& item) {
+        Cell* cell = &cells_[dequeue_pos_ & mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        if (intptr_t(sequence) - intptr_t(dequeue_pos_ + 1) < 0) {
+            return false;
+        }
+        T* stored = reinterpret_cast<T*>(&cell->storage);
+        item = std::move(*stored);
+        stored->~T();
+        cell->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+
+    /**
+     * Whether an element may be claimed but not yet popped, exact for the consumer
+     * once producers are quiescent
+     */
+    bool empty() const {
+        return enqueue_pos_.load(std::memory_order_seq_cst) == dequeue_pos_;
+    }
+
+    /**
+     * Bytes of the preallocated cells
+     */
+    size_t memory_usage() const { return (mask_ + 1) * sizeof(Cell); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    static constexpr size_t kCacheLine = 64;
+
+    // Producer and consumer positions live on separate cache lines
+    Cell* cells_;
+    size_t mask_;
+    char pad0_[kCacheLine];
+    std::atomic<size_t> enqueue_pos_{0};
+    char pad1_[kCacheLine];
+    size_t dequeue_pos_ = 0;
+};
@@ -0,0 +1,60 @@
+#include "node_pool.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kMinChunkNodes = 64;
+
+} // namespace
+
+NodePool::NodePool(size_t reserve) : reserve_(reserve) {}
+
+NodePool::~NodePool() {
+    for (void* chunk : chunks_) {
+        ::operator delete(chunk);
+    }
+}
+
+size_t NodePool::round_(size_t size) {
+    const size_t align = alignof(std::max_align_t);
+    size = std::max(size, sizeof(FreeNode));
+    return (size + align - 1) / align * align;
+}
+
+bool NodePool::accepts(size_t size, size_t align) {
+    if (align > alignof(std::max_align_t)) {
+        return false;
+    }
+    if (node_size_ == 0) {
+        node_size_ = round_(size);
+    }
+    return round_(size) == node_size_;
+}
+
+void* NodePool::allocate() {
+    if (!free_) {
+        // Double the capacity every time the pool runs dry
+        grow_(capacity_ == 0 ? std::max(reserve_, kMinChunkNodes) : capacity_);
+    }
+    FreeNode* node = free_;
+    free_ = node->next;
+    return node;
+}
+
+void NodePool::deallocate(void* node) noexcept {
+    FreeNode* free_node = static_cast<FreeNode*>(node);
+    free_node->next = free_;
+    free_ = free_node;
+}
+
+void NodePool::grow_(size_t nodes) {
+    chunks_.reserve(chunks_.size() + 1);
+    char* chunk = static_cast<char*>(::operator new(nodes * node_size_));
+    chunks_.push_back(chunk);
+    // Thread the new nodes in address order so that consecutive allocations are adjacent
+    for (size_t i = nodes; i-- > 0;) {
+        deallocate(chunk + i * node_size_);
+    }
+    capacity_ += nodes;
+}
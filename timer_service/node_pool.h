@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * Free-list allocator of fixed-size nodes, carved out of large chunks.
+ *
+ * The node size is bound by the first allocation, so that a pool can serve the internal
+ * node type of a standard container through PoolAllocator. Freed nodes are kept for reuse
+ * and only released when the pool is destroyed. Not thread safe.
+ */
+class NodePool {
+public:
+    /**
+     * @param reserve Number of nodes allocated up front by the first allocation
+     */
+    explicit NodePool(size_t reserve = 0);
+    ~NodePool();
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    /**
+     * Whether objects of the given size and alignment are served by the pool.
+     * Binds the node size if not done yet.
+     */
+    bool accepts(size_t size, size_t align);
+
+    /**
+     * Whether objects of the given size were served by the pool, does not bind the node size
+     */
+    bool serves(size_t size) const { return node_size_ != 0 && round_(size) == node_size_; }
+
+    void* allocate();
+    void deallocate(void* node) noexcept;
+
+    size_t node_size() const { return node_size_; }
+    size_t capacity() const { return capacity_; }
+
+    /**
+     * Bytes allocated for nodes, free ones included
+     */
+    size_t memory_usage() const { return capacity_ * node_size_; }
+
+private:
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    static size_t round_(size_t size);
+    void grow_(size_t nodes);
+
+    size_t node_size_ = 0;
+    size_t reserve_;
+    size_t capacity_ = 0;
+    FreeNode* free_ = nullptr;
+    std::vector<void*> chunks_;
+};
+
+/**
+ * Standard allocator drawing single objects from a NodePool, so that node-based containers
+ * stop hitting the global allocator. Arrays (e.g. hash buckets) still use operator new.
+ */
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    explicit PoolAllocator(NodePool* pool) noexcept : pool_(pool) {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : pool_(other.pool()) {}
+
+    T* allocate(size_t n) {
+        if (n == 1 && pool_->accepts(sizeof(T), alignof(T))) {
+            return static_cast<T*>(pool_->allocate());
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if (n == 1 && pool_->serves(sizeof(T))) {
+            pool_->deallocate(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    NodePool* pool() const noexcept { return pool_; }
+
+private:
+    NodePool* pool_;
+};
+
+template<typename T, typename U>
+bool operator==(const PoolAllocator<T>& lhs, const PoolAllocator<U>& rhs) noexcept {
+    return lhs.pool() == rhs.pool();
+}
+
+template<typename T, typename U>
+bool operator!=(const PoolAllocator<T>& lhs, const PoolAllocator<U>& rhs) noexcept {
+    return lhs.pool() != rhs.pool();
+}
@@ -0,0 +1,126 @@
+#include "sharded_timer_service.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// Process-wide ordinal of the calling thread, dealt on first use
+size_t thread_ordinal() {
+    static std::atomic<size_t> next_ordinal(0);
+    thread_local size_t ordinal = next_ordinal++;
+    return ordinal;
+}
+
+} // namespace
+
+constexpr unsigned ShardedTimerService::kShardBits;
+constexpr size_t ShardedTimerService::kMaxShards;
+constexpr unsigned ShardedTimerService::kShardShift;
+constexpr ShardedTimerService::TimerId ShardedTimerService::kLocalMask;
+
+ShardedTimerService::ShardedTimerService() : ShardedTimerService(ShardedTimerServiceConfig()) {}
+
+ShardedTimerService::ShardedTimerService(const ShardedTimerServiceConfig& config) {
+    unsigned cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t count = config.shards == 0 ? cpus : config.shards;
+    if (count > kMaxShards) {
+        throw std::invalid_argument("ShardedTimerService: too many shards");
+    }
+    shards_.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        TimerServiceConfig shard_config = config.shard;
+        if (config.pin_workers) {
+            shard_config.worker_cpu = int(i % cpus);
+        }
+        shards_.emplace_back(new TimerService(shard_config));
+    }
+}
+
+bool ShardedTimerService::cancel(TimerId id) {
+    TimerService* shard = shard_of_(id);
+    return shard && shard->cancel(id & kLocalMask);
+}
+
+bool ShardedTimerService::cancel_and_wait(TimerId id) {
+    TimerService* shard = shard_of_(id);
+    return shard && shard->cancel_and_wait(id & kLocalMask);
+}
+
+bool ShardedTimerService::reschedule(TimerId id, std::chrono::steady_clock::duration delay) {
+    TimerService* shard = shard_of_(id);
+    return shard && shard->reschedule(id & kLocalMask, delay);
+}
+
+bool ShardedTimerService::reset(TimerId id) {
+    TimerService* shard = shard_of_(id);
+    return shard && shard->reset(id & kLocalMask);
+}
+
+size_t ShardedTimerService::cancel_group(uint64_t group) {
+    size_t cancelled = 0;
+    for (auto& shard : shards_) {
+        cancelled += shard->cancel_group(group);
+    }
+    return cancelled;
+}
+
+void ShardedTimerService::shutdown() {
+    for (auto& shard : shards_) {
+        shard->shutdown();
+    }
+}
+
+size_t ShardedTimerService::pending_callbacks() const {
+    size_t pending = 0;
+    for (auto& shard : shards_) {
+        pending += shard->pending_callbacks();
+    }
+    return pending;
+}
+
+TimerServiceStats ShardedTimerService::stats() const {
+    TimerServiceStats total;
+    for (auto& shard : shards_) {
+        TimerServiceStats stats = shard->stats();
+        total.enabled = stats.enabled;
+        total.queue_depth += stats.queue_depth;
+        total.tombstones += stats.tombstones;
+        total.max_queue_depth += stats.max_queue_depth;
+        total.scheduled += stats.scheduled;
+        total.cancelled += stats.cancelled;
+        total.fired += stats.fired;
+        total.periods_skipped += stats.periods_skipped;
+        total.backlog += stats.backlog;
+        total.backlog_age = std::max(total.backlog_age, stats.backlog_age);
+        total.max_backlog += stats.max_backlog;
+        total.shed += stats.shed;
+        total.lateness.merge(stats.lateness);
+        total.callback_time.merge(stats.callback_time);
+    }
+    return total;
+}
+
+TimerServiceMemory ShardedTimerService::memory_usage() const {
+    TimerServiceMemory total;
+    for (auto& shard : shards_) {
+        TimerServiceMemory memory = shard->memory_usage();
+        total.timers += memory.timers;
+        total.queue += memory.queue;
+        total.slots += memory.slots;
+        total.extras += memory.extras;
+        total.groups += memory.groups;
+        total.callbacks += memory.callbacks;
+        total.other += memory.other;
+    }
+    return total;
+}
+
+TimerService* ShardedTimerService::shard_of_(TimerId id) const {
+    size_t shard = size_t(id >> kShardShift);
+    return shard < shards_.size() ? shards_[shard].get() : nullptr;
+}
+
+size_t ShardedTimerService::caller_shard_() const {
+    return thread_ordinal() % shards_.size();
+}
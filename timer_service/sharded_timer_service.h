@@ -0,0 +1,147 @@
+#pragma once
+
+#include "timer_service.h"
+
+#include <vector>
+
+/**
+ * Construction parameters of a ShardedTimerService.
+ */
+struct ShardedTimerServiceConfig {
+    // Number of independent shards, 0 for one per hardware thread, at most kMaxShards
+    size_t shards = 0;
+    // Pin the worker thread of shard i to CPU i modulo the number of CPUs (Linux only)
+    bool pin_workers = false;
+    // Configuration of every shard, worker_cpu is overridden by pin_workers
+    TimerServiceConfig shard;
+};
+
+/**
+ * Timer service spread over independent TimerService shards, each with its own queue,
+ * lock and worker thread, so that schedulers on many cores do not contend on one mutex.
+ *
+ * schedule() goes to the shard of the calling thread: threads are dealt shards round robin
+ * the first time they schedule. The shard is encoded in the top bits of the TimerId, so
+ * cancel() goes straight to it from any thread.
+ */
+class ShardedTimerService {
+public:
+    using TimerId = TimerService::TimerId;
+
+    static constexpr unsigned kShardBits = 8;
+    static constexpr size_t kMaxShards = size_t(1) << kShardBits;
+
+    ShardedTimerService();
+    explicit ShardedTimerService(const ShardedTimerServiceConfig& config);
+
+    ShardedTimerService(const ShardedTimerService&) = delete;
+    ShardedTimerService& operator=(const ShardedTimerService&) = delete;
+
+    /**
+     * Schedule a timer on the shard of the calling thread, see TimerService::schedule()
+     */
+    template<typename Rep, typename Period, typename Func, typename Arg>
+    TimerId schedule(std::chrono::duration<Rep, Period> delay, Func&& callback, Arg&& arg, int repeat = 0,
+                     const TimerOptions& options = TimerOptions()) {
+        size_t shard = caller_shard_();
+        return encode_(shard, shards_[shard]->schedule(delay, std::forward<Func>(callback),
+                                                       std::forward<Arg>(arg), repeat, options));
+    }
+
+    /**
+     * Schedule many timers on the shard of the calling thread, see TimerService::schedule_batch()
+     */
+    template<typename Range>
+    std::vector<TimerId> schedule_batch(const Range& timers, const TimerOptions& options = TimerOptions()) {
+        size_t shard = caller_shard_();
+        std::vector<TimerId> ids = shards_[shard]->schedule_batch(timers, options);
+        for (TimerId& id : ids) {
+            id = encode_(shard, id);
+        }
+        return ids;
+    }
+
+    /**
+     * Cancel a timer scheduled on any shard, see TimerService::cancel()
+     */
+    bool cancel(TimerId id);
+
+    /**
+     * Cancel a timer and wait for its running callback, see TimerService::cancel_and_wait()
+     */
+    bool cancel_and_wait(TimerId id);
+
+    /**
+     * Reschedule a timer scheduled on any shard, see TimerService::reschedule()
+     */
+    bool reschedule(TimerId id, std::chrono::steady_clock::duration delay);
+
+    /**
+     * Restart a timer scheduled on any shard, see TimerService::reset()
+     */
+    bool reset(TimerId id);
+
+    /**
+     * Cancel many timers, with one lock hold per shard involved, see TimerService::cancel_batch()
+     */
+    template<typename Range>
+    size_t cancel_batch(const Range& ids) {
+        std::vector<std::vector<TimerId>> per_shard(shards_.size());
+        for (TimerId id : ids) {
+            size_t shard = size_t(id >> kShardShift);
+            if (shard < shards_.size()) {
+                per_shard[shard].push_back(id & kLocalMask);
+            }
+        }
+        size_t cancelled = 0;
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            if (!per_shard[shard].empty()) {
+                cancelled += shards_[shard]->cancel_batch(per_shard[shard]);
+            }
+        }
+        return cancelled;
+    }
+
+    /**
+     * Cancel the timers of a group on every shard, see TimerService::cancel_group()
+     */
+    size_t cancel_group(uint64_t group);
+
+    /**
+     * Shut every shard down, see TimerService::shutdown()
+     */
+    void shutdown();
+
+    /**
+     * Sum of the pending callbacks of every shard, see TimerService::pending_callbacks()
+     */
+    size_t pending_callbacks() const;
+
+    /**
+     * Instrumentation summed over the shards, see TimerService::stats(). The maximum queue
+     * depth is the sum of the per-shard maxima.
+     */
+    TimerServiceStats stats() const;
+
+    /**
+     * Memory summed over the shards, see TimerService::memory_usage()
+     */
+    TimerServiceMemory memory_usage() const;
+
+    size_t shards() const { return shards_.size(); }
+
+private:
+    static constexpr unsigned kShardShift = 64 - kShardBits;
+    static constexpr TimerId kLocalMask = (TimerId(1) << kShardShift) - 1;
+
+    static TimerId encode_(size_t shard, TimerId local) { return (TimerId(shard) << kShardShift) | local; }
+
+    size_t caller_shard_() const;
+
+    /**
+     * Shard a timer was scheduled on, nullptr for an invalid id
+     */
+    TimerService* shard_of_(TimerId id) const;
+
+    std::vector<std::unique_ptr<TimerService>> shards_;
+};
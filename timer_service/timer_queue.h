@@ -0,0 +1,178 @@
+#pragma once
+
+#include "inplace_callback.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Inline buffer of the timer callbacks, callbacks with larger captures are heap allocated
+#ifndef TIMER_SERVICE_CALLBACK_SIZE
+#define TIMER_SERVICE_CALLBACK_SIZE 64
+#endif
+
+using TimerCallback = InplaceCallback<TIMER_SERVICE_CALLBACK_SIZE>;
+
+/**
+ * What a repeating timer does with the periods it missed, when its callback or the worker
+ * ran late enough for the next expiry to be already past.
+ */
+enum class CatchUpPolicy : uint8_t {
+    FireAll, // Fire every missed period back to back, keeping the number of callbacks
+    Skip     // Drop the missed periods and wait for the next expiry still ahead
+};
+
+/**
+ * Class of a timer when expired timers queue up faster than they are fired: within a batch and
+ * under the fire limit of the service, critical timers go ahead of normal ones, normal ones
+ * ahead of best effort ones. Within a class timers keep their expiry order.
+ */
+enum class TimerPriority : uint8_t {
+    Critical,
+    Normal,
+    BestEffort // May also be shed when late, see TimerServiceConfig::shed_lateness
+};
+
+struct TimerData;
+struct PersistentTimer;
+
+/**
+ * Side record of the timers that repeat, belong to a group or carry a serial key, kept out of
+ * TimerData so that the common single shot timer stays small. Pooled and owned by TimerService.
+ */
+struct TimerExtra {
+    uint64_t serial_key = 0; // Callbacks sharing a non zero key never run concurrently
+    uint64_t group = 0;      // Group the timer belongs to, 0 for none
+    // Repetitions expire at origin + periods * period, so that late callbacks do not drift
+    // the schedule. Set when armed and on every reschedule.
+    std::chrono::steady_clock::time_point origin{};
+    uint64_t periods = 0;
+    TimerData* group_prev = nullptr; // Siblings in the group list
+    TimerData* group_next = nullptr;
+    const PersistentTimer* persistent = nullptr; // Handler and argument to snapshot, if persistent
+};
+
+/**
+ * State of a single armed timer, shared by every queue backend.
+ *
+ * Ordered by size so that it packs in two cache lines with the default callback buffer.
+ * period, repeat and deferred_expiry stay here rather than in TimerExtra: reset() and lazy
+ * reschedules need the first and last for single shot timers too, and the aligned callback
+ * pads the record to 128 bytes with or without repeat and period.
+ */
+struct TimerData {
+    using Id = uint64_t;
+
+    TimerCallback callback;
+    Id id = 0;
+    std::chrono::steady_clock::duration period{0}; // Delay the timer was scheduled with, at clock resolution
+    int repeat = 0;
+    std::chrono::duration<int32_t, std::milli> slack{0}; // The timer may fire up to slack after its expiry
+    CatchUpPolicy catch_up = CatchUpPolicy::FireAll;
+    TimerPriority priority = TimerPriority::Normal;
+    bool firing = false;     // Detached while its callback runs, or held back by a fire limit
+    bool held = false;       // Expired but held back by a fire limit, its callback has not run
+    bool cancelled = false;  // Cancelled while its callback was running
+    // Later expiry set by a reschedule, applied lazily when the queued one comes due.
+    // time_point::min() when none.
+    std::chrono::steady_clock::time_point deferred_expiry = std::chrono::steady_clock::time_point::min();
+    TimerExtra* extra = nullptr; // Repeating, grouped or serialised timers only
+};
+
+/**
+ * Data structures available to hold the armed timers of a TimerService.
+ */
+enum class TimerQueueBackend {
+    Tree,   // Ordered tree, exact expiry, O(log n) insert
+    Wheel,  // Hierarchical timing wheel, tick resolution, O(1) insert/cancel/expiry
+    Heap    // 4-ary heap in contiguous storage, exact expiry, O(log n) insert, cache friendly
+};
+
+/**
+ * Interface of the queue that keeps the armed timers ordered by expiry.
+ * Implementations are not thread safe, TimerService serialises every call.
+ *
+ * A timer taken out by pop_expired() is only detached from the ordering: its TimerData
+ * stays at the same address, owned by the queue, until it is handed back with rearm()
+ * or destroyed with release(). Periodic timers thus never move nor reallocate. Destroying the
+queue destroys the queued timers only, the owner releases the detached ones.
+ *
+ * A timer is due from its expiry on and must be served before expiry + slack. Backends use
+ * that window to serve neighbouring timers with a single wake-up.
+ */
+class TimerQueue {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    virtual ~TimerQueue() = default;
+
+    /**
+     * Insert a timer.
+     *
+     * @param expiry Point in time the timer is due at
+     * @param data Timer to insert
+     * @return the stored timer, whose address is stable until it is destroyed
+     */
+    virtual TimerData* push(TimePoint expiry, TimerData&& data) = 0;
+
+    /**
+     * Remove and destroy a queued timer.
+     *
+     * @param data Stored timer, must not be detached
+     */
+    virtual void erase(TimerData* data) = 0;
+
+    /**
+     * Move a queued timer to a new expiry, in place.
+     *
+     * @param data Stored timer, must not be detached
+     * @param expiry New expiry of the timer
+     */
+    virtual void reposition(TimerData* data, TimePoint expiry) = 0;
+
+    /**
+     * Expiry a queued timer was pushed or rearmed with.
+     *
+     * @param data Stored timer, must not be detached
+     */
+    virtual TimePoint expiry(const TimerData* data) const = 0;
+
+    // Queued timers only, detached ones are not accounted
+    virtual bool empty() const = 0;
+    virtual size_t size() const = 0;
+
+    /**
+     * Point in time the owner has to wake up at to serve the queue, at the latest the first
+     * expiry + slack. May be earlier (e.g. wheel cascades). Only valid if not empty.
+     */
+    virtual TimePoint next_expiry() const = 0;
+
+    /**
+     * Detach one timer that is due at now.
+     *
+     * @param now Current time
+     * @param expiry Set to the expiry the timer was pushed with
+     * @return the detached timer, nullptr if none is due
+     */
+    virtual TimerData* pop_expired(TimePoint now, TimePoint& expiry) = 0;
+
+    /**
+     * Put a detached timer back in the ordering, in place.
+     *
+     * @param data Timer returned by pop_expired()
+     * @param expiry New expiry of the timer
+     */
+    virtual void rearm(TimerData* data, TimePoint expiry) = 0;
+
+    /**
+     * Destroy a detached timer.
+     *
+     * @param data Timer returned by pop_expired()
+     */
+    virtual void release(TimerData* data) = 0;
+
+    /**
+     * Bytes held by the queue for its timers, free pooled nodes and spare capacity included
+     */
+    virtual size_t memory_usage() const = 0;
+};
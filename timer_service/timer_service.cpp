@@ -1,77 +1,1088 @@
 #include "timer_service.h"
+#include "heap_timer_queue.h"
+#include "tree_timer_queue.h"
+#include "wheel_timer_queue.h"
 
-TimerService::TimerService() : running_(true), next_id_(1) {
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+void pin_thread(std::thread& thread, int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+std::unique_ptr<TimerQueue> make_queue(const TimerServiceConfig& config) {
+    switch (config.backend) {
+    case TimerQueueBackend::Wheel:
+        return std::unique_ptr<TimerQueue>(new WheelTimerQueue(
+            config.wheel_tick, config.wheel_levels, config.wheel_slot_bits, config.expected_timers,
+            config.manual_clock ? config.manual_clock_start : std::chrono::steady_clock::now()));
+    case TimerQueueBackend::Heap:
+        return std::unique_ptr<TimerQueue>(new HeapTimerQueue(config.expected_timers));
+    case TimerQueueBackend::Tree:
+    default:
+        return std::unique_ptr<TimerQueue>(new TreeTimerQueue(config.expected_timers));
+    }
+}
+
+// Spin-wait hint, lets the sibling hyperthread run and saves power while polling the clock
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+int create_timer_fd() {
+#ifdef __linux__
+    // steady_clock is CLOCK_MONOTONIC, deadlines are passed as they are
+    return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
+// Fewer tombstones than this are left to be dropped when they come due
+constexpr size_t kMinCompaction = 64;
+
+// Callback running on this thread, for cancel_and_wait() to tell a callback that would wait
+// on itself
+thread_local const TimerService* firing_service = nullptr;
+thread_local TimerData::Id firing_timer = 0;
+
+class FiringScope {
+public:
+    FiringScope(const TimerService* service, TimerData::Id id) : service_(firing_service), id_(firing_timer) {
+        firing_service = service;
+        firing_timer = id;
+    }
+    ~FiringScope() {
+        firing_service = service_;
+        firing_timer = id_;
+    }
+
+private:
+    const TimerService* service_;
+    TimerData::Id id_;
+};
+
+} // namespace
+
+constexpr TimerService::TimePoint::rep TimerService::kAwake;
+constexpr TimerService::TimePoint::rep TimerService::kIdle;
+
+TimerService::TimerService() : TimerService(TimerServiceConfig()) {}
+
+TimerService::TimerService(size_t expected_timers) : TimerService([expected_timers] {
+    TimerServiceConfig config;
+    config.expected_timers = expected_timers;
+    return config;
+}()) {}
+
+TimerService::TimerService(const TimerServiceConfig& config)
+    : queue_(make_queue(config)),
+      slots_(config.expected_timers),
+      executor_(config.executor_threads > 0 && !config.manual_clock ? new CallbackExecutor(config.executor_threads) : nullptr),
+      extra_pool_(0),
+      groups_(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), decltype(groups_)::allocator_type(&group_pool_)),
+      default_slack_(config.default_slack),
+      max_batch_(std::max<size_t>(config.max_batch, 1)),
+      lazy_cancel_(config.lazy_cancel),
+      precise_(config.precise),
+      spin_threshold_(std::chrono::duration_cast<TimePoint::duration>(config.spin_threshold)),
+      fire_limit_(config.fire_limit),
+      fire_interval_(std::chrono::duration_cast<TimePoint::duration>(config.fire_interval)),
+      shed_lateness_(std::chrono::duration_cast<TimePoint::duration>(config.shed_lateness)),
+      compaction_threshold_(config.compaction_threshold),
+      submissions_(config.lock_free_submission ? new BoundedMpscQueue<Command>(config.submission_capacity) : nullptr),
+      sleep_until_(kAwake),
+      stats_(config.collect_stats ? new Stats() : nullptr),
+      manual_clock_(config.manual_clock),
+      manual_now_(config.manual_clock_start.time_since_epoch().count()),
+      threadless_(config.threadless || config.manual_clock),
+      timer_fd_(config.threadless && !config.manual_clock ? create_timer_fd() : -1),
+      running_(true),
+      shutdown_policy_(config.shutdown) {
+    extra_pool_.accepts(sizeof(TimerExtra), alignof(TimerExtra));
+    batch_.reserve(max_batch_);
+    ordered_.reserve(max_batch_);
+    if (threadless_) {
+        sleep_until_.store(kIdle);
+        return;
+    }
     worker_thread_ = std::thread(&TimerService::worker_, this);
+    if (config.worker_cpu >= 0) {
+        pin_thread(worker_thread_, config.worker_cpu);
+    }
 }
 
 TimerService::~TimerService() {
+    shutdown();
+    // The queue destroys the queued timers, the ones left detached by dropped tasks remain
+    slots_.for_each([this](TimerData* data) {
+        if (data->firing) {
+            queue_->release(data);
+        }
+    });
+#ifdef __linux__
+    if (timer_fd_ >= 0) {
+        ::close(timer_fd_);
+    }
+#endif
+}
+
+void TimerService::shutdown() {
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stopping_) {
+            // Another caller joins the threads, wait until it is done
+            fire_cv_.wait(lock, [this] { return stopped_; });
+            return;
+        }
+        stopping_ = true;
         running_ = false;
     }
-    cv_.notify_one();
+    cv_.notify_all();
     if (worker_thread_.joinable()) {
         worker_thread_.join();
     }
+    // Tasks in flight still reference the queue, stop the pool first
+    if (executor_) {
+        executor_->stop(shutdown_policy_ == ShutdownPolicy::Flush);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (shutdown_policy_ == ShutdownPolicy::Flush) {
+        flush_(lock);
+    }
+    stopped_ = true;
+    // Timers left detached by dropped tasks never finish, and concurrent shutdown() calls return
+    fire_cv_.notify_all();
+}
+
+void TimerService::flush_(std::unique_lock<std::mutex>& lock) {
+    drain_submissions_(true);
+    // Held back timers are overdue, they go first
+    std::vector<Expired> pending;
+    for (auto& backlog : backlog_) {
+        pending.insert(pending.end(), backlog.begin(), backlog.end());
+        backlog.clear();
+    }
+    backlog_size_ = 0;
+    TimePoint expiry;
+    while (TimerData* data = queue_->pop_expired(TimePoint::max(), expiry)) {
+        data->firing = true;
+        pending.push_back(Expired{data, expiry});
+    }
+    // Timers cancelled until now are dropped, later cancellations only stop repetitions
+    size_t live = 0;
+    for (const Expired& expired : pending) {
+        expired.data->held = false;
+        if (expired.data->cancelled || (lazy_cancel_ && slots_.dead(expired.data->id))) {
+            finish_fire_(expired.data);
+        } else {
+            pending[live++] = expired;
+        }
+    }
+    pending.resize(live);
+
+    // Timers scheduled by these callbacks are not fired, running_ is off
+    lock.unlock();
+    for (const Expired& expired : pending) {
+        fire_(expired.data, expired.expiry);
+    }
+    lock.lock();
+    for (const Expired& expired : pending) {
+        finish_fire_(expired.data);
+    }
+}
+
+void TimerService::wake_(std::unique_lock<std::mutex>& lock) {
+    drain_submissions_();
+    if (threadless_) {
+        // The host loop only learns about an earlier deadline through the timer fd
+        if (!queue_->empty() && queue_->next_expiry() < fd_deadline_) {
+            arm_timer_fd_();
+        }
+        lock.unlock();
+        return;
+    }
+    // An awake worker (kAwake) looks at the queue before sleeping again, a sleeping one only
+    // needs to know about a deadline before its own
+    bool notify = !queue_->empty() && queue_->next_expiry().time_since_epoch().count() < sleep_until_.load();
+    if (notify) {
+        sleep_until_.store(kAwake); // Notified already, later producers do not notify again
+    }
+    lock.unlock();
+    // After unlocking, so that the worker does not wake up straight into the held lock
+    if (notify) {
+        cv_.notify_one();
+    }
+}
+
+void TimerService::arm_timer_fd_() {
+    while (true) {
+        TimePoint deadline = queue_->empty() ? TimePoint::max() : queue_->next_expiry();
+        if (deadline != fd_deadline_) {
+            fd_deadline_ = deadline;
+#ifdef __linux__
+            if (timer_fd_ >= 0) {
+                itimerspec spec{};
+                if (deadline != TimePoint::max()) {
+                    // A zero value disarms the timer, a past deadline fires at once
+                    auto ns = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        deadline.time_since_epoch()).count(), 1);
+                    spec.it_value.tv_sec = time_t(ns / 1000000000);
+                    spec.it_value.tv_nsec = long(ns % 1000000000);
+                }
+                timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+            }
+#endif
+        }
+        if (!submissions_) {
+            return;
+        }
+        // Same handoff as sleep_(): producers only take the lock for an earlier deadline
+        sleep_until_.store(deadline == TimePoint::max() ? kIdle : deadline.time_since_epoch().count());
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (submissions_->empty()) {
+            return;
+        }
+        drain_submissions_();
+    }
+}
+
+size_t TimerService::process_expired(TimePoint now) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!running_) {
+        return 0; // Shut down, the executor pool is stopped
+    }
+#ifdef __linux__
+    if (timer_fd_ >= 0) {
+        uint64_t expirations;
+        ssize_t consumed = ::read(timer_fd_, &expirations, sizeof(expirations)); // Clear readiness
+        (void)consumed;
+        // The fd is spent once read: rearm it below even if the deadline did not move, as when
+        // the host passes a cached time earlier than the expiry it was woken up for
+        fd_deadline_ = TimePoint::min();
+    }
+#endif
+    size_t fired = 0;
+    while (true) {
+        prepare_();
+        if (queue_->empty() || !collect_expired_(now)) {
+            break;
+        }
+        if (mixed_priorities_) {
+            prioritize_();
+        }
+        // A partial batch took every due timer, rearmed ones wait for the next call
+        bool full = batch_.size() == max_batch_;
+        fired += batch_.size();
+        run_batch_(lock);
+        if (!full) {
+            break;
+        }
+    }
+    arm_timer_fd_();
+    return fired;
+}
+
+size_t TimerService::advance_to(TimePoint time) {
+    size_t fired = 0;
+    while (true) {
+        TimePoint next = next_expiry();
+        if (next > time) {
+            break;
+        }
+        // Stop at every expiry on the way, so that callbacks observe their own expiry as now()
+        if (next > now()) {
+            manual_now_.store(next.time_since_epoch().count(), std::memory_order_release);
+        }
+        size_t batch = process_expired(now());
+        if (batch == 0 && next_expiry() <= next) {
+            break; // Nothing due before the wake-up (e.g. a pending cascade), keep the time moving
+        }
+        fired += batch;
+    }
+    if (time > now()) {
+        manual_now_.store(time.time_since_epoch().count(), std::memory_order_release);
+    }
+    return fired;
+}
+
+TimerService::TimePoint TimerService::next_expiry() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_->empty() ? TimePoint::max() : queue_->next_expiry();
+}
+
+TimerService::TimerId TimerService::submit_(TimePoint expiry, TimerData&& data, const TimerOptions& options,
+                                            const PersistentTimer* persistent) {
+    TimerId id = data.id;
+    TIMER_SERVICE_TRACE(Schedule, id, (expiry - now()).count());
+    if (submissions_) {
+        Command command{expiry, std::move(data), false, options.serial_key, options.group, persistent};
+        if (submissions_->try_push(std::move(command))) {
+            // Pairs with the fence in sleep_(): either the worker sees the command before
+            // sleeping, or this thread sees the deadline it sleeps on
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (expiry.time_since_epoch().count() < sleep_until_.load()) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_(lock); // Only when landing before the deadline the worker sleeps on
+            }
+            return id;
+        }
+        // Queue full, apply directly behind the commands already submitted
+        data = std::move(command.data);
+        std::unique_lock<std::mutex> lock(mutex_);
+        drain_submissions_(true);
+        schedule_until(expiry, std::move(data), options.serial_key, options.group, persistent);
+        wake_(lock);
+        return id;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    schedule_until(expiry, std::move(data), options.serial_key, options.group, persistent);
+    wake_(lock); // Wake up worker thread if the timer is the new earliest
+    return id;
+}
+
+std::vector<TimerService::TimerId> TimerService::submit_batch_(std::vector<Command>&& commands) {
+    std::vector<TimerId> ids;
+    ids.reserve(commands.size());
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_(true);
+    for (Command& command : commands) {
+        TIMER_SERVICE_TRACE(Schedule, command.data.id, (command.expiry - now()).count());
+        ids.push_back(schedule_until(command.expiry, std::move(command.data), command.serial_key, command.group,
+                                     command.persistent));
+    }
+    wake_(lock); // Wake up worker thread, at most once for the whole batch
+    return ids;
 }
 
 bool TimerService::cancel(TimerId id) {
+    if (lazy_cancel_) {
+        if (!slots_.kill(id)) {
+            return false;
+        }
+        tombstones_.fetch_add(1, std::memory_order_relaxed);
+        TIMER_SERVICE_TRACE(Cancel, id, 0);
+        return true;
+    }
+    if (submissions_) {
+        // A cancellation never needs the worker awake, it is applied before the next expiry
+        Command command{TimePoint(), TimerData{TimerCallback(), id}, true, 0, 0, nullptr};
+        if (submissions_->try_push(std::move(command))) {
+            return slots_.live(id);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        drain_submissions_(true);
+        return cancel_locked_(id);
+    }
+
+    // No wake-up: a cancellation only moves the next expiry later, the worker waking up
+    // for it at the previous deadline costs no more than waking it now
     std::lock_guard<std::mutex> lock(mutex_);
-    for (auto it = timers_.begin(); it != timers_.end(); ++it) {
-        if (it->second.id == id) {
-            timers_.erase(it);
-            cv_.notify_one(); // Wake up worker to recalculate next wait time
-            return true;
+    return cancel_locked_(id);
+}
+
+bool TimerService::cancel_and_wait(TimerId id) {
+    // Cancelled under the lock rather than submitted, for an exact result
+    bool cancelled = lazy_cancel_ ? cancel(id) : false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_(true);
+    if (!lazy_cancel_) {
+        cancelled = cancel_locked_(id);
+    }
+    // The callbacks of a batch run in turn on one thread, only the executor runs them apart
+    if (firing_service == this && (!executor_ || firing_timer == id)) {
+        return cancelled;
+    }
+    ++fire_waiters_;
+    fire_cv_.wait(lock, [this, id] { return stopped_ || !in_flight_(id); });
+    --fire_waiters_;
+    return cancelled;
+}
+
+bool TimerService::in_flight_(TimerId id) const {
+    // A held back timer has not fired yet, a cancelled one is dropped when the backlog reaches it
+    const TimerData* data = slots_.bound(id);
+    return data && data->firing && !data->held;
+}
+
+bool TimerService::cancel_locked_(TimerId id) {
+    TimerData* data = slots_.find(id);
+    if (!data) {
+        return false;
+    }
+    if (data->firing) {
+        // A timer is detached from the queue while its callback runs, stop its next repetition.
+        // A held back one has not fired yet, it is dropped when the backlog reaches it.
+        if ((data->repeat == 0 && !data->held) || data->cancelled) {
+            return false;
         }
+        data->cancelled = true;
+    } else {
+        drop_(data, true);
     }
-    return false;
+    if (stats_) {
+        ++stats_->cancelled;
+    }
+    TIMER_SERVICE_TRACE(Cancel, id, 0);
+    return true;
 }
 
-void TimerService::worker_() {
+bool TimerService::reschedule(TimerId id, TimePoint::duration delay) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_(true);
+    bool rescheduled = reschedule_locked_(id, delay);
+    wake_(lock); // The timer may have moved earlier
+    return rescheduled;
+}
+
+bool TimerService::reset(TimerId id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_(true);
+    bool rescheduled = reschedule_locked_(id, TimePoint::duration(-1));
+    wake_(lock); // The timer may have moved earlier
+    return rescheduled;
+}
+
+bool TimerService::reschedule_locked_(TimerId id, TimePoint::duration delay) {
+    TimerData* data = slots_.find(id);
+    if (!data || data->cancelled) {
+        return false;
+    }
+    TimePoint expiry = now() + (delay.count() < 0 ? data->period : delay);
+    TIMER_SERVICE_TRACE(Reschedule, id, (delay.count() < 0 ? data->period : delay).count());
+    if (data->held) {
+        // Held back by the fire limit and not fired yet: out of the backlog, back in the queue
+        auto& backlog = backlog_[size_t(data->priority)];
+        backlog.erase(std::find_if(backlog.begin(), backlog.end(),
+                                   [data](const Expired& expired) { return expired.data == data; }));
+        --backlog_size_;
+        data->held = false;
+        data->firing = false;
+        data->deferred_expiry = TimePoint::min();
+        restart_period_(data, expiry);
+        queue_->rearm(data, expiry);
+        return true;
+    }
+    if (data->firing) {
+        // Already fired, only a repeating timer has a next expiry to move
+        if (data->repeat == 0) {
+            return false;
+        }
+        data->deferred_expiry = expiry;
+        return true;
+    }
+    if (expiry >= queue_->expiry(data)) {
+        // Later than queued: leave the queue alone until the queued expiry comes due
+        data->deferred_expiry = expiry;
+        return true;
+    }
+    data->deferred_expiry = TimePoint::min();
+    restart_period_(data, expiry);
+    queue_->reposition(data, expiry);
+    return true;
+}
+
+void TimerService::drop_(TimerData* data, bool queued) {
+    unlink_group_(data);
+    if (data->extra) {
+        extra_pool_.deallocate(data->extra);
+        data->extra = nullptr;
+    }
+    slots_.release(data->id);
+    if (queued) {
+        queue_->erase(data);
+    } else {
+        queue_->release(data);
+    }
+}
+
+void TimerService::discard_(TimerData* data, bool queued) {
+    tombstones_.fetch_sub(1, std::memory_order_relaxed);
+    if (stats_) {
+        ++stats_->cancelled;
+    }
+    drop_(data, queued);
+}
+
+void TimerService::compact_() {
+    slots_.for_each([this](TimerData* data) {
+        if (!data->firing && slots_.dead(data->id)) {
+            compacted_.push_back(data);
+        }
+    });
+    for (TimerData* data : compacted_) {
+        discard_(data, true);
+    }
+    compacted_.clear();
+}
+
+size_t TimerService::cancel_group(uint64_t group) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_submissions_(true);
+    auto head = groups_.find(group);
+    if (head == groups_.end()) {
+        return 0;
+    }
+    size_t cancelled = 0;
+    TimerData* data = head->second;
+    while (data) {
+        TimerData* next = data->extra->group_next;
+        cancelled += cancel_locked_(data->id) ? 1 : 0;
+        data = next;
+    }
+    return cancelled;
+}
+
+void TimerService::link_group_(TimerData* data) {
+    TimerExtra* extra = data->extra;
+    auto inserted = groups_.emplace(extra->group, data);
+    if (!inserted.second) {
+        TimerData* head = inserted.first->second;
+        extra->group_next = head;
+        head->extra->group_prev = data;
+        inserted.first->second = data;
+    }
+}
+
+void TimerService::unlink_group_(TimerData* data) {
+    TimerExtra* extra = data->extra;
+    if (!extra || extra->group == 0) {
+        return;
+    }
+    if (extra->group_next) {
+        extra->group_next->extra->group_prev = extra->group_prev;
+    }
+    if (extra->group_prev) {
+        extra->group_prev->extra->group_next = extra->group_next;
+    } else if (extra->group_next) {
+        groups_[extra->group] = extra->group_next;
+    } else {
+        groups_.erase(extra->group);
+    }
+    extra->group_prev = extra->group_next = nullptr;
+}
+
+void TimerService::drain_submissions_(bool all) {
+    if (!submissions_) {
+        return;
+    }
+    Command command;
     while (true) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        
-        // Check if we should stop
-        if (!running_) {
+        while (submissions_->try_pop(command)) {
+            if (command.cancel) {
+                cancel_locked_(command.data.id);
+            } else {
+                schedule_until(command.expiry, std::move(command.data), command.serial_key, command.group,
+                               command.persistent);
+            }
+        }
+        if (!all || submissions_->empty()) {
             break;
         }
-        
+        // A producer between claiming and publishing a cell holds no lock, it is done shortly
+        std::this_thread::yield();
+    }
+}
+
+void TimerService::sleep_(std::unique_lock<std::mutex>& lock, TimePoint deadline) {
+    // Producers only notify for a timer landing before the deadline
+    sleep_until_.store(deadline == TimePoint::max() ? kIdle : deadline.time_since_epoch().count());
+    if (submissions_) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!submissions_->empty()) {
+            sleep_until_.store(kAwake);
+            return;
+        }
+    }
+    if (deadline == TimePoint::max()) {
+        cv_.wait(lock);
+    } else {
+        cv_.wait_until(lock, deadline);
+    }
+    sleep_until_.store(kAwake);
+}
+
+void TimerService::spin_(std::unique_lock<std::mutex>& lock, TimePoint deadline) {
+    // Published like a sleep deadline, a producer arming an earlier timer resets it to kAwake
+    sleep_until_.store(deadline.time_since_epoch().count());
+    if (submissions_) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!submissions_->empty()) {
+            sleep_until_.store(kAwake);
+            return;
+        }
+    }
+    lock.unlock();
+    while (std::chrono::steady_clock::now() < deadline && sleep_until_.load(std::memory_order_relaxed) != kAwake &&
+           running_.load(std::memory_order_relaxed)) {
+        cpu_relax();
+    }
+    lock.lock();
+    sleep_until_.store(kAwake);
+}
+
+TimerServiceMemory TimerService::memory_usage() const {
+    TimerServiceMemory memory;
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_.for_each([&memory](TimerData* data) {
+        ++memory.timers;
+        memory.callbacks += data->callback.heap_size();
+    });
+    memory.queue = queue_->memory_usage();
+    memory.slots = slots_.memory_usage();
+    memory.extras = extra_pool_.memory_usage();
+    memory.groups = group_pool_.memory_usage() + groups_.bucket_count() * sizeof(void*);
+    memory.other = (batch_.capacity() + ordered_.capacity()) * sizeof(Expired);
+    if (submissions_) {
+        memory.other += submissions_->memory_usage();
+    }
+    return memory;
+}
+
+TimerData TimerService::make_persistent_(const TimerHandler& handler, std::string&& payload,
+                                        TimePoint::duration period, int repeat, const TimerOptions& options,
+                                        const PersistentTimer*& persistent) {
+    std::unique_ptr<PersistentTimer> timer(new PersistentTimer{&handler, std::move(payload)});
+    persistent = timer.get();
+    return TimerData{make_callback_([](std::unique_ptr<PersistentTimer>& timer) { timer->handler->call(timer->payload); },
+                                    std::move(timer)),
+                     slots_.acquire(), period, repeat, slack_(options), options.catch_up,
+                     options.priority};
+}
+
+size_t TimerService::snapshot(const std::string& path) {
+    std::vector<TimerSnapshotRecord> records;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        drain_submissions_(true);
+        TimePoint steady = now();
+        auto wall = std::chrono::system_clock::now();
+        auto save = [&](const TimerData* data, TimePoint expiry, int repeat) {
+            const TimerExtra* extra = data->extra;
+            if (!extra || !extra->persistent || data->cancelled || (lazy_cancel_ && slots_.dead(data->id))) {
+                return;
+            }
+            TimerSnapshotRecord record;
+            record.expiry = wall + std::chrono::duration_cast<std::chrono::system_clock::duration>(expiry - steady);
+            record.period = data->period;
+            record.repeat = repeat;
+            record.slack = data->slack;
+            record.catch_up = data->catch_up;
+            record.priority = data->priority;
+            record.serial_key = extra->serial_key;
+            record.group = extra->group;
+            record.key = extra->persistent->handler->key;
+            record.payload = extra->persistent->payload;
+            records.push_back(std::move(record));
+        };
+        // Held back timers are overdue, they have not fired
+        for (const auto& backlog : backlog_) {
+            for (const Expired& expired : backlog) {
+                save(expired.data, expired.expiry, expired.data->repeat);
+            }
+        }
+        slots_.for_each([&](const TimerData* data) {
+            TimePoint deferred = data->deferred_expiry;
+            if (!data->firing) {
+                save(data, deferred != TimePoint::min() ? deferred : queue_->expiry(data), data->repeat);
+            } else if (!data->held && data->repeat != 0 && data->extra) {
+                // Running, only its next repetition is left
+                TimePoint next = data->extra->origin + data->period * (data->extra->periods + 1);
+                if (deferred != TimePoint::min()) {
+                    next = deferred;
+                }
+                save(data, next, data->repeat > 0 ? data->repeat - 1 : data->repeat);
+            }
+        });
+    }
+    // In expiry order, so that restore() appends to the queue rather than inserting at random
+    std::sort(records.begin(), records.end(), [](const TimerSnapshotRecord& a, const TimerSnapshotRecord& b) {
+        return a.expiry < b.expiry;
+    });
+    write_timer_snapshot(path, records);
+    return records.size();
+}
+
+size_t TimerService::restore(const std::string& path, const TimerHandlerRegistry& handlers) {
+    std::vector<TimerSnapshotRecord> records = read_timer_snapshot(path);
+    TimePoint steady = now();
+    auto wall = std::chrono::system_clock::now();
+    size_t restored = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_(true);
+    for (TimerSnapshotRecord& record : records) {
+        const TimerHandler* handler = handlers.find(record.key);
+        if (!handler) {
+            continue; // Retired since the snapshot was taken
+        }
+        TimerOptions options;
+        options.slack = record.slack;
+        options.catch_up = record.catch_up;
+        options.priority = record.priority;
+        const PersistentTimer* persistent;
+        TimerData data = make_persistent_(*handler, std::move(record.payload),
+                                          std::chrono::duration_cast<TimePoint::duration>(record.period), record.repeat,
+                                          options, persistent);
+        TimePoint expiry = steady + std::chrono::duration_cast<TimePoint::duration>(record.expiry - wall);
+        TIMER_SERVICE_TRACE(Schedule, data.id, (expiry - steady).count());
+        schedule_until(expiry, std::move(data), record.serial_key, record.group, persistent);
+        ++restored;
+    }
+    wake_(lock); // Once for the whole snapshot
+    return restored;
+}
+
+TimerServiceStats TimerService::stats() const {
+    TimerServiceStats stats;
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.queue_depth = queue_->size();
+    stats.tombstones = tombstones_.load(std::memory_order_relaxed);
+    stats.backlog = backlog_size_;
+    TimePoint oldest = queue_->empty() ? TimePoint::max() : queue_->next_expiry();
+    for (const auto& backlog : backlog_) {
+        if (!backlog.empty()) {
+            oldest = std::min(oldest, backlog.front().expiry);
+        }
+    }
+    if (oldest != TimePoint::max()) {
+        stats.backlog_age = std::max(TimePoint::duration(0), now() - oldest);
+    }
+    if (stats_) {
+        stats.enabled = true;
+        stats.max_queue_depth = stats_->max_queue_depth;
+        stats.scheduled = stats_->scheduled;
+        stats.cancelled = stats_->cancelled;
+        stats.periods_skipped = stats_->periods_skipped;
+        stats.max_backlog = stats_->max_backlog;
+        stats.shed = stats_->shed;
+        stats.lateness = stats_->lateness.snapshot();
+        stats.callback_time = stats_->callback_time.snapshot();
+        stats.fired = stats.lateness.count();
+    }
+    return stats;
+}
+
+size_t TimerService::pending_callbacks() const {
+    return executor_ ? executor_->pending() : 0;
+}
+
+void TimerService::worker_() {
+    TIMER_SERVICE_TRACE_THREAD("timer worker");
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Check if we should stop
+    while (running_) {
+        prepare_();
+
+        if (fire_limit_ > 0) {
+            serve_limited_(lock);
+            continue;
+        }
+
         // If no timers, wait for notification
-        if (timers_.empty()) {
-            cv_.wait(lock);
+        if (queue_->empty()) {
+            sleep_(lock, TimePoint::max());
             continue;
         }
-        
-        auto now = std::chrono::steady_clock::now();
-        auto it = timers_.begin();
-        
-        if (it->first <= now) {
-            // Timer expired, execute callback
-            auto data = std::move(it->second);
-            timers_.erase(it);
-
-            // Release the lock before executing the callback and re-scheduling the timer
-            lock.unlock();
-            // Restart the timer if requested
-            if(data.repeat != 0) {
-                if(data.repeat > 0) {
-                    data.repeat--;
-                }
-                schedule_until(it->first + data.period, std::move(data));
+
+        TimePoint current = now();
+        if (!collect_expired_(current)) {
+            TimePoint deadline = queue_->next_expiry();
+            if (!precise_) {
+                // Wait until next timer expires or notification
+                sleep_(lock, deadline);
+            } else if (deadline - current > spin_threshold_) {
+                // Leave the last stretch to spin_(), the kernel wake-up may overshoot by as much
+                sleep_(lock, deadline - spin_threshold_);
+            } else {
+                spin_(lock, deadline);
+            }
+            continue;
+        }
+        if (mixed_priorities_) {
+            prioritize_();
+        }
+        run_batch_(lock);
+    }
+}
+
+void TimerService::prepare_() {
+    // Apply the submitted schedules and cancellations first
+    drain_submissions_();
+
+    if (lazy_cancel_) {
+        size_t tombstones = tombstones_.load(std::memory_order_relaxed);
+        if (tombstones >= kMinCompaction && double(tombstones) > compaction_threshold_ * double(queue_->size())) {
+            compact_();
+        }
+    }
+}
+
+bool TimerService::collect_expired_(TimePoint now) {
+    // Take every expired timer out at once, the timers stay detached in the queue
+    // until their callback has run
+    TimePoint expiry;
+    TimePoint previous = TimePoint::min();
+    uint64_t saved = 0;
+    mixed_priorities_ = false;
+    while (batch_.size() < max_batch_) {
+        TimerData* data = queue_->pop_expired(now, expiry);
+        if (!data) {
+            break;
+        }
+        if (lazy_cancel_ && slots_.dead(data->id)) {
+            discard_(data, false);
+            continue;
+        }
+        if (data->deferred_expiry != TimePoint::min()) {
+            // Rescheduled later meanwhile, the timer only moves now
+            expiry = data->deferred_expiry;
+            data->deferred_expiry = TimePoint::min();
+            restart_period_(data, expiry);
+            if (expiry > now) {
+                queue_->rearm(data, expiry);
+                continue;
+            }
+        }
+        if (sheddable_(data, expiry, now)) {
+            shed_(data);
+            continue;
+        }
+        // A distinct expiry still ahead of its deadline would have woken the worker again
+        if (!batch_.empty() && expiry != previous && expiry + data->slack > now) {
+            ++saved;
+        }
+        previous = expiry;
+        data->firing = true;
+        if (!batch_.empty() && data->priority != batch_.front().data->priority) {
+            mixed_priorities_ = true;
+        }
+        batch_.push_back(Expired{data, expiry});
+    }
+    if (saved > 0) {
+        wakeups_saved_.fetch_add(saved, std::memory_order_relaxed);
+    }
+    return !batch_.empty();
+}
+
+void TimerService::prioritize_() {
+    // One pass per class rather than a stable sort, which may allocate
+    for (TimerPriority priority : {TimerPriority::Critical, TimerPriority::Normal, TimerPriority::BestEffort}) {
+        for (const Expired& expired : batch_) {
+            if (expired.data->priority == priority) {
+                ordered_.push_back(expired);
             }
+        }
+    }
+    batch_.swap(ordered_);
+    ordered_.clear();
+}
+
+void TimerService::serve_limited_(std::unique_lock<std::mutex>& lock) {
+    TimePoint current = now();
+    // Move the expired timers to the backlog before firing any, so that they go by priority
+    bool more = !queue_->empty() && collect_expired_(current) && batch_.size() == max_batch_;
+    for (const Expired& expired : batch_) {
+        expired.data->held = true;
+        backlog_[size_t(expired.data->priority)].push_back(expired);
+    }
+    backlog_size_ += batch_.size();
+    batch_.clear();
+    if (stats_) {
+        stats_->max_backlog = std::max(stats_->max_backlog, backlog_size_);
+    }
+    if (more) {
+        return; // Drain every expired timer first, a critical one may come after a full batch
+    }
+
+    if (current >= window_end_) {
+        window_end_ = current + fire_interval_;
+        window_fired_ = 0;
+    }
+    if (backlog_size_ > 0 && window_fired_ < fire_limit_) {
+        take_backlog_(current);
+        if (!batch_.empty()) {
+            window_fired_ += batch_.size();
+            run_batch_(lock);
+            return;
+        }
+    }
+    TimePoint deadline = queue_->empty() ? TimePoint::max() : queue_->next_expiry();
+    if (backlog_size_ > 0) {
+        // Budget of the interval spent, the backlog waits for the next one
+        deadline = std::min(deadline, window_end_);
+    }
+    sleep_(lock, deadline);
+}
 
-            // Execute callback
-            data.callback();
+void TimerService::take_backlog_(TimePoint now) {
+    size_t budget = std::min(fire_limit_ - window_fired_, max_batch_);
+    for (auto& backlog : backlog_) {
+        while (!backlog.empty() && batch_.size() < budget) {
+            Expired expired = backlog.front();
+            backlog.pop_front();
+            --backlog_size_;
+            TimerData* data = expired.data;
+            data->held = false;
+            if (data->cancelled || (lazy_cancel_ && slots_.dead(data->id))) {
+                finish_fire_(data); // Cancelled while held, never fired
+            } else if (sheddable_(data, expired.expiry, now)) {
+                shed_(data);
+            } else {
+                batch_.push_back(expired);
+            }
+        }
+    }
+}
+
+bool TimerService::sheddable_(const TimerData* data, TimePoint expiry, TimePoint now) const {
+    // A repeating timer without period would be due again at once, it is never shed
+    return data->priority == TimerPriority::BestEffort && shed_lateness_.count() > 0 &&
+           now - expiry > shed_lateness_ && (data->repeat == 0 || data->period.count() > 0);
+}
+
+void TimerService::shed_(TimerData* data) {
+    TIMER_SERVICE_TRACE(Shed, data->id, 0);
+    if (stats_) {
+        ++stats_->shed;
+    }
+    data->firing = true;
+    finish_fire_(data, true); // Released, or rearmed past the missed periods
+}
+
+void TimerService::run_batch_(std::unique_lock<std::mutex>& lock) {
+    // Release the lock before executing the callbacks
+    lock.unlock();
+    if (executor_) {
+        for (const Expired& expired : batch_) {
+            TimerData* data = expired.data;
+            TimePoint fired_expiry = expired.expiry;
+            executor_->submit([this, data, fired_expiry] {
+                fire_(data, fired_expiry);
+                std::unique_lock<std::mutex> lock(mutex_);
+                finish_fire_(data);
+                wake_(lock); // The worker may sleep past the rearmed expiry
+            }, data->extra ? data->extra->serial_key : 0);
+        }
+        batch_.clear();
+        lock.lock();
+        return;
+    }
+
+    for (const Expired& expired : batch_) {
+        fire_(expired.data, expired.expiry);
+    }
+
+    // Rearm or release the whole batch in a single critical section
+    lock.lock();
+    for (const Expired& expired : batch_) {
+        finish_fire_(expired.data);
+    }
+    batch_.clear();
+}
+
+void TimerService::fire_(TimerData* data, TimePoint expiry) {
+    FiringScope scope(this, data->id);
+    TIMER_SERVICE_TRACE(FireBegin, data->id, (now() - expiry).count());
+    if (!stats_) {
+        data->callback();
+    } else {
+        stats_->lateness.record(now() - expiry);
+        auto start = std::chrono::steady_clock::now();
+        data->callback();
+        stats_->callback_time.record(std::chrono::steady_clock::now() - start);
+    }
+    TIMER_SERVICE_TRACE(FireEnd, data->id, 0);
+}
+
+void TimerService::restart_period_(TimerData* data, TimePoint expiry) {
+    if (data->extra) {
+        data->extra->origin = expiry;
+        data->extra->periods = 0;
+    }
+}
+
+void TimerService::finish_fire_(TimerData* data, bool collapse) {
+    if (lazy_cancel_ && slots_.dead(data->id)) {
+        discard_(data, false);
+    } else if (data->repeat != 0 && !data->cancelled && running_) {
+        // Restart the timer in place if requested and not cancelled meanwhile, no
+        // allocation nor callback copy involved
+        if (data->repeat > 0) {
+            data->repeat--;
+        }
+        data->firing = false;
+        TimerExtra* extra = data->extra; // Always set for a repeating timer
+        if (data->deferred_expiry != TimePoint::min()) {
+            // Rescheduled while its callback ran
+            restart_period_(data, data->deferred_expiry);
+            data->deferred_expiry = TimePoint::min();
         } else {
-            // Wait until next timer expires or notification
-            cv_.wait_until(lock, it->first);
+            ++extra->periods;
         }
+        // Counted from the first expiry rather than from the fire time, so that neither a late
+        // worker nor the callback run time shifts later repetitions
+        TimePoint next = extra->origin + data->period * extra->periods;
+        if ((collapse || data->catch_up == CatchUpPolicy::Skip) && data->period.count() > 0) {
+            TimePoint current = now();
+            if (next <= current) {
+                uint64_t missed = uint64_t((current - next) / data->period) + 1;
+                extra->periods += missed;
+                next += data->period * missed;
+                if (stats_) {
+                    stats_->periods_skipped += missed;
+                }
+            }
+        }
+        queue_->rearm(data, next);
+    } else {
+        drop_(data, false);
+    }
+    if (fire_waiters_ > 0) {
+        fire_cv_.notify_all();
     }
 }
 
-TimerService::TimerId TimerService::schedule_until(std::chrono::steady_clock::time_point expiry, TimerData&& data) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    timers_.emplace(expiry, data);
-    cv_.notify_one(); // Wake up worker thread
-    return data.id;
+TimerService::TimerId TimerService::schedule_until(std::chrono::steady_clock::time_point expiry, TimerData&& data,
+                                                   uint64_t serial_key, uint64_t group,
+                                                   const PersistentTimer* persistent) {
+    TimerData* stored = queue_->push(expiry, std::move(data));
+    if (stored->repeat != 0 || serial_key != 0 || group != 0 || persistent) {
+        stored->extra = ::new (extra_pool_.allocate()) TimerExtra{serial_key, group};
+        stored->extra->persistent = persistent;
+    }
+    restart_period_(stored, expiry);
+    slots_.bind(stored->id, stored);
+    if (group != 0) {
+        link_group_(stored);
+    }
+    if (stats_) {
+        ++stats_->scheduled;
+        stats_->max_queue_depth = std::max(stats_->max_queue_depth, queue_->size());
+    }
+    return stored->id;
 }
@@ -1,23 +1,202 @@
+#pragma once
+
+#include "callback_executor.h"
+#include "latency_histogram.h"
+#include "mpsc_queue.h"
+#include "node_pool.h"
+#include "timer_queue.h"
+#include "timer_slots.h"
+#include "timer_snapshot.h"
+#include "timer_trace.h"
+
+#include <algorithm>
 #include <functional>
+#include <iterator>
+#include <tuple>
+#include <unordered_map>
 #include <chrono>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <map>
+#include <deque>
 #include <memory>
 #include <atomic>
 #include <iostream>
+#include <limits>
 #include <string>
+#include <vector>
+#include <future>
+#include <exception>
+#include <type_traits>
+
+// Awaitable API of TimerService. Set by the build for a C++20 library rather than detected
+// here, so that every translation unit sees the same class.
+#ifdef TIMER_SERVICE_COROUTINES
+#ifndef __cpp_impl_coroutine
+#error "TIMER_SERVICE_COROUTINES requires a compiler with coroutine support"
+#endif
+#include <coroutine>
+#include <optional>
+#endif
+
+/**
+ * Fate of the timers still armed when a TimerService shuts down, see TimerService::shutdown().
+ */
+enum class ShutdownPolicy : uint8_t {
+    Discard, // Destroy them unfired, and drop the callbacks queued on the executor pool
+    Flush,   // Run the queued callbacks, then fire every armed timer once, in expiry order
+};
+
+/**
+ * Construction parameters of a TimerService.
+ */
+struct TimerServiceConfig {
+    // Data structure holding the armed timers
+    TimerQueueBackend backend = TimerQueueBackend::Tree;
+    // Wheel backend only: tick resolution, number of levels and log2 of the slots per level.
+    // The defaults cover 2^32 ticks (~50 days at 1 ms) before the overflow list is used.
+    std::chrono::nanoseconds wheel_tick = std::chrono::milliseconds(1);
+    unsigned wheel_levels = 4;
+    unsigned wheel_slot_bits = 8;
+    // Number of timers the queue nodes and index are reserved for, the pools grow beyond it
+    size_t expected_timers = 0;
+    // Threads of the callback executor pool, 0 runs the callbacks on the timing thread
+    size_t executor_threads = 0;
+    // CPU the timing thread is pinned to, negative to leave it floating (Linux only). Give the
+    // worker a core of its own in precise mode, so that spinning neither competes nor migrates.
+    int worker_cpu = -1;
+    // Precise mode for sub-millisecond timers: the worker sleeps until spin_threshold before
+    // the next expiry, then busy-spins on the clock, trading CPU time for microsecond jitter
+    // instead of the wake-up latency of the kernel. Worker thread only, not threadless.
+    bool precise = false;
+    std::chrono::nanoseconds spin_threshold = std::chrono::microseconds(100);
+    // Hand schedule() and cancel() to the worker through a lock-free queue instead of taking
+    // the service lock. Producers fall back to the lock when the queue is full.
+    bool lock_free_submission = false;
+    size_t submission_capacity = 4096;
+    // Maximum number of expired timers taken out per wake-up, bounds how long a burst of
+    // expiries holds the service lock
+    size_t max_batch = 1024;
+    // Overload protection: fire at most fire_limit callbacks per fire_interval, 0 for no limit.
+    // Expired timers wait in a backlog served by priority then expiry, so that the backlog
+    // left by a stall drains at a bounded rate, critical timers first. Worker thread only.
+    size_t fire_limit = 0;
+    std::chrono::nanoseconds fire_interval = std::chrono::milliseconds(1);
+    // Best effort timers served later than this past their expiry are shed: a single shot
+    // timer is dropped without firing, a repeating one skips to its next period ahead.
+    // 0 never sheds. To collapse the missed periods of any repeating timer, see CatchUpPolicy::Skip.
+    std::chrono::nanoseconds shed_lateness{0};
+    // Minimum slack of every timer, see TimerOptions::slack
+    std::chrono::milliseconds default_slack{0};
+    // Start no worker thread: the host event loop polls fd() and calls process_expired(),
+    // callbacks then run on the loop thread (or on the executor pool if configured)
+    bool threadless = false;
+    // Run on a virtual clock that only moves with advance_to(), for simulations and tests.
+    // Implies threadless (without fd), callbacks run on the caller of advance_to() and
+    // executor_threads is ignored. The clock starts at manual_clock_start.
+    bool manual_clock = false;
+    std::chrono::steady_clock::time_point manual_clock_start;
+    // Let cancel() only tombstone the timer, without the service lock nor a wake-up. The
+    // worker drops dead timers when they come due, and sweeps the queue once dead timers
+    // exceed compaction_threshold times the queued ones. Suits workloads where most timers
+    // are cancelled, especially with the heap and wheel backends.
+    bool lazy_cancel = false;
+    double compaction_threshold = 0.5;
+    // Record the counters and latency histograms returned by stats(). When off, the hot
+    // path only tests a null pointer.
+    bool collect_stats = false;
+    // What shutdown() and the destructor do with the timers still armed
+    ShutdownPolicy shutdown = ShutdownPolicy::Discard;
+};
+
+/**
+ * Snapshot of the instrumentation of a TimerService, see TimerService::stats().
+ */
+struct TimerServiceStats {
+    bool enabled = false;       // Whether the fields below are collected
+    size_t queue_depth = 0;     // Timers armed at the time of the snapshot, always set
+    size_t max_queue_depth = 0; // Highest number of armed timers
+    size_t tombstones = 0;      // Lazily cancelled timers not reclaimed yet, always set
+    uint64_t scheduled = 0;
+    uint64_t cancelled = 0;
+    uint64_t fired = 0;         // Callbacks started, one per repetition
+    uint64_t periods_skipped = 0; // Missed periods dropped by CatchUpPolicy::Skip
+    // Overload: the backlog is the number of expired timers held back by the fire limit, its
+    // age how far the earliest expiry not served yet is behind the clock. Both are always set,
+    // alert on them before the backlog snowballs.
+    size_t backlog = 0;
+    std::chrono::nanoseconds backlog_age{0};
+    size_t max_backlog = 0;
+    uint64_t shed = 0;          // Best effort expiries dropped, see TimerServiceConfig::shed_lateness
+    HistogramSnapshot lateness;      // From the expiry of a timer to the start of its callback
+    HistogramSnapshot callback_time; // Duration of the callbacks
+};
+
+/**
+ * Timer armed by TimerService::schedule_future(), with the future of its callback.
+ */
+template<typename Result>
+struct TimerFuture {
+    TimerData::Id id;
+    std::future<Result> future;
+};
+
+/**
+ * Memory held by a TimerService, see TimerService::memory_usage().
+ */
+struct TimerServiceMemory {
+    size_t timers = 0;     // Armed timers, firing ones included
+    size_t queue = 0;      // Queue backend: timer nodes, ordering structure and free pooled nodes
+    size_t slots = 0;      // Timer id table
+    size_t extras = 0;     // Side records of repeating, grouped and serialised timers
+    size_t groups = 0;     // Group index
+    size_t callbacks = 0;  // Callbacks too large for the inline buffer, on the heap
+    size_t other = 0;      // Submission queue and worker buffers
+
+    size_t total() const { return queue + slots + extras + groups + callbacks + other; }
+
+    /**
+     * Bytes per armed timer, spare capacity spread over them, to plan capacity from
+     */
+    double bytes_per_timer() const { return timers ? double(total()) / double(timers) : 0.0; }
+};
+
+/**
+ * Optional per-timer scheduling parameters.
+ */
+struct TimerOptions {
+    // Callbacks of timers sharing a non zero key never run concurrently on the executor
+    // pool (e.g. the address of their owner). Ignored when callbacks run on the timing thread.
+    uint64_t serial_key = 0;
+    // Group tag (e.g. a session id) to cancel the timer along with its group, 0 for none
+    uint64_t group = 0;
+    // Tolerance past the expiry within which the timer may fire, letting the service serve
+    // neighbouring expiries with one wake-up (like Linux timerslack). Capped at INT32_MAX
+    // milliseconds, about 24.8 days.
+    std::chrono::milliseconds slack{0};
+    // Repeating timers only: fire or drop the periods missed while overloaded
+    CatchUpPolicy catch_up = CatchUpPolicy::FireAll;
+    // Order among expired timers when the service falls behind
+    TimerPriority priority = TimerPriority::Normal;
+};
 
 /**
  * A generic timer service that manages multiple timers with a single worker thread.
  * Callbacks can accept any type of argument, which is copied and stored with the timer.
+ * Callbacks run on the worker thread, or on an executor pool when so configured.
  */
 class TimerService {
 public:
-    using TimerId = uint64_t;
+    using TimerId = TimerData::Id;
 
     TimerService();
+    explicit TimerService(const TimerServiceConfig& config);
+
+    /**
+     * Build a service whose queue is pre-reserved for the given number of armed timers,
+     * so that steady state scheduling and firing do not allocate.
+     */
+    explicit TimerService(size_t expected_timers);
     ~TimerService();
 
     // Delete copy and move operations
@@ -30,66 +209,762 @@ public:
      * Schedule a timer that will call the callback with the given argument after delay.
      * The argument is copied and stored within the timer.
      *
-     * @param delay Time to wait before executing callback
+     * @param delay Time to wait before executing callback, any std::chrono::duration. Kept at
+     * steady_clock resolution, sub-millisecond delays are only as precise as the wake-up of
+     * the worker, see TimerServiceConfig::precise.
      * @param callback Function to call (must return void and accept single argument)
-     * @param arg Argument to pass to callback (will be copied)
+     * @param arg Argument to pass to callback (will be copied, or moved from an rvalue)
+     * The callback and argument are stored inline in the timer when they fit in
+     * TIMER_SERVICE_CALLBACK_SIZE bytes, otherwise on the heap. Neither has to be copyable:
+     * move-only arguments such as std::unique_ptr are passed to the callback as an lvalue,
+     * the same object on every repetition.
      * @param repeat: 0 for a single shot timer, a negative value for an endless timer and any positive value for specifc repeat count
+     * @param options Optional scheduling parameters
      * @return TimerId that can be used to cancel the timer
      */
-    template<typename Func, typename Arg>
-    TimerId schedule(std::chrono::milliseconds delay, Func&& callback, Arg&& arg, int repeat = 0) {
-        auto expiry = std::chrono::steady_clock::now() + delay;
+    template<typename Rep, typename Period, typename Func, typename Arg>
+    TimerId schedule(std::chrono::duration<Rep, Period> delay, Func&& callback, Arg&& arg, int repeat = 0,
+                     const TimerOptions& options = TimerOptions()) {
+        auto period = std::chrono::duration_cast<TimePoint::duration>(delay);
+        auto expiry = now() + period;
+        return submit_(expiry, TimerData{make_callback_(std::forward<Func>(callback), std::forward<Arg>(arg)),
+                                         slots_.acquire(), period, repeat,
+                                         slack_(options), options.catch_up,
+                                         options.priority},
+                       options);
+    }
 
-        // Create a type-erased wrapper that captures both callback and argument
-        // The argument is copied here, so caller doesn't need to preserve it
-        auto timer_callback = [callback = std::forward<Func>(callback),
-                              arg = std::forward<Arg>(arg)]() mutable {
-            callback(arg);
-        };
+    /**
+     * Schedule many timers at once, in a single lock hold with a single wake-up.
+     *
+     * @param timers Range of tuple-like (delay, callback, arg, repeat) elements, e.g.
+     * std::vector<std::tuple<std::chrono::milliseconds, Func, Arg, int>>, with any duration
+     * type as delay. Callbacks and arguments are copied.
+     * @param options Optional scheduling parameters, applied to every timer
+     * @return Ids of the timers, in range order
+     */
+    template<typename Range>
+    std::vector<TimerId> schedule_batch(const Range& timers, const TimerOptions& options = TimerOptions()) {
+        auto start = now();
+        size_t count = size_t(std::distance(std::begin(timers), std::end(timers)));
+        std::vector<Command> commands;
+        commands.reserve(count);
+        for (const auto& timer : timers) {
+            auto delay = std::chrono::duration_cast<TimePoint::duration>(std::get<0>(timer));
+            commands.push_back(Command{start + delay,
+                                       TimerData{make_callback_(std::get<1>(timer), std::get<2>(timer)),
+                                                 slots_.acquire(), delay, std::get<3>(timer),
+                                                 slack_(options), options.catch_up,
+                                                 options.priority},
+                                       false, options.serial_key, options.group, nullptr});
+        }
+        return submit_batch_(std::move(commands));
+    }
 
-        std::lock_guard<std::mutex> lock(mutex_);
-        TimerId id = next_id_++;
-        timers_.emplace(expiry, TimerData{id, std::move(timer_callback), repeat, delay});
-        cv_.notify_one(); // Wake up worker thread
-        return id;
+    /**
+     * Schedule a persistent timer: one that snapshot() saves and restore() brings back after a
+     * restart, calling a registered handler with an argument encoded by TimerCodec<Arg>.
+     *
+     * @param delay Time to wait before calling the handler, any std::chrono::duration
+     * @param handler Handler returned by TimerHandlerRegistry::add(), must outlive the timer
+     * @param arg Argument encoded once, and decoded on every call
+     * @param repeat: 0 for a single shot timer, a negative value for an endless timer and any positive value for specifc repeat count
+     * @param options Optional scheduling parameters, saved with the timer
+     * @return TimerId that can be used to cancel the timer
+     */
+    template<typename Rep, typename Period, typename Arg>
+    TimerId schedule_persistent(std::chrono::duration<Rep, Period> delay, const TimerHandler& handler, const Arg& arg,
+                                int repeat = 0, const TimerOptions& options = TimerOptions()) {
+        std::string payload;
+        TimerCodec<Arg>::encode(arg, payload);
+        auto period = std::chrono::duration_cast<TimePoint::duration>(delay);
+        const PersistentTimer* persistent;
+        TimerData data = make_persistent_(handler, std::move(payload), period, repeat, options, persistent);
+        return submit_(now() + period, std::move(data), options, persistent);
+    }
+
+    /**
+     * Schedule a single shot timer whose outcome is delivered through a future: the value
+     * returned by the callback, or the exception it threw. Cancelling the timer (or destroying
+     * the service before it fires) breaks the promise, get() then throws std::future_error.
+     *
+     * @param delay Time to wait before executing callback, any std::chrono::duration
+     * @param callback Function to call with the argument, may return a value
+     * @param arg Argument to pass to callback (will be copied, or moved from an rvalue)
+     * @param options Optional scheduling parameters
+     * @return Id of the timer, to cancel it, and the future
+     */
+    template<typename Rep, typename Period, typename Func, typename Arg,
+             typename Result = decltype(std::declval<typename std::decay<Func>::type&>()(
+                 std::declval<typename std::decay<Arg>::type&>()))>
+    TimerFuture<Result> schedule_future(std::chrono::duration<Rep, Period> delay, Func&& callback, Arg&& arg,
+                                        const TimerOptions& options = TimerOptions()) {
+        std::promise<Result> promise;
+        TimerFuture<Result> result{0, promise.get_future()};
+        result.id = schedule(delay,
+                             [callback = std::forward<Func>(callback), promise = std::move(promise)](
+                                 typename std::decay<Arg>::type& arg) mutable { fulfil_(promise, callback, arg); },
+                             std::forward<Arg>(arg), 0, options);
+        return result;
+    }
+
+    /**
+     * Future that becomes ready once delay has elapsed, to wait on a deadline from a thread
+     * that is not driven by callbacks.
+     */
+    template<typename Rep, typename Period>
+    TimerFuture<void> schedule_future(std::chrono::duration<Rep, Period> delay,
+                                      const TimerOptions& options = TimerOptions()) {
+        return schedule_future(delay, [](int) {}, 0, options);
+    }
+
+#ifdef TIMER_SERVICE_COROUTINES
+    class SleepAwaiter;
+    template<typename Awaitable> class TimeoutAwaiter;
+
+    /**
+     * Awaitable suspending the awaiting coroutine for delay: co_await service.sleep_for(d).
+     * The coroutine handle is the argument of the timer, stored inline in its callback, so that
+     * suspending allocates nothing beyond the timer itself. The coroutine resumes where the
+     * callbacks run: on the worker thread, the executor pool, or in process_expired() and
+     * advance_to(). The service must outlive the sleeping coroutines.
+     *
+     * @param delay Time to sleep, any std::chrono::duration, does not suspend when not positive
+     * @param options Optional scheduling parameters
+     */
+    template<typename Rep, typename Period>
+    SleepAwaiter sleep_for(std::chrono::duration<Rep, Period> delay, const TimerOptions& options = TimerOptions());
+
+    /**
+     * Await an operation for at most delay: co_await service.with_timeout(operation, d).
+     * Evaluates to a std::optional of the result of the operation, empty on timeout, or to a
+     * bool telling whether a void operation completed in time. Exceptions of the operation are
+     * rethrown. The timer is cancelled when the operation completes first. On timeout the
+     * operation is left running until it completes, its result then dropped: it should
+     * reference nothing owned by the frame of the awaiting coroutine.
+     *
+     * @param awaitable Operation to await, an awaiter or a type with a member operator co_await,
+     * moved (or copied) into heap storage shared with the timer
+     */
+    template<typename Awaitable, typename Rep, typename Period>
+    TimeoutAwaiter<typename std::decay<Awaitable>::type> with_timeout(Awaitable&& awaitable,
+                                                                      std::chrono::duration<Rep, Period> delay) {
+        return TimeoutAwaiter<typename std::decay<Awaitable>::type>(
+            *this, std::forward<Awaitable>(awaitable), std::chrono::duration_cast<TimePoint::duration>(delay));
     }
+#endif
 
     /**
      * Cancel a scheduled timer by ID.
      *
      * @param id Timer ID returned from schedule()
-     * @return true if timer was found and cancelled, false otherwise
+     * Timer ids are generation-tagged slots: the timer is located by an array access, the
+     * id of a timer that already fired or was cancelled is rejected by its generation.
+     *
+     * @return true if timer was found and cancelled, false otherwise. With lock-free
+     * submission the cancellation is applied later by the worker, true then only means
+     * that the timer was still armed when the cancellation was submitted. With lazy
+     * cancellation the timer is only tombstoned, true is also returned for a single shot
+     * timer whose callback is running.
+     *
+     * A timer taken out for firing can no longer be cancelled before its callback runs: for
+     * a single shot timer false is returned, a repeating one is cancelled and guaranteed not
+     * to fire again once its running callback returns.
      */
     bool cancel(TimerId id);
 
+    /**
+     * Cancel a timer and block until its callback, if running or about to run, has returned.
+     * Called from a callback, only a callback running on another executor thread is waited
+     * for, as the caller would otherwise wait on itself; never wait that way for a timer
+     * sharing the serial key of the calling callback.
+     *
+     * @param id Timer ID returned from schedule()
+     * @return as cancel(), once the timer can no longer fire: false for a single shot timer
+     * whose callback has run meanwhile
+     */
+    bool cancel_and_wait(TimerId id);
+
+    /**
+     * Stop the service: join the timing thread and the executor pool, then discard or fire
+     * the timers still armed according to TimerServiceConfig::shutdown. Called by the
+     * destructor, idempotent: concurrent callers return once the first one is done. Timers
+     * scheduled afterwards never fire, call it before destroying what the callbacks
+     * reference, and never from a callback.
+     */
+    void shutdown();
+
+    /**
+     * Move an armed timer to a new expiry, keeping its id, callback and repeat count.
+     * Pushing the expiry later is lazy: the queue is only touched once the previous expiry
+     * comes due. A repeating timer continues its period from the new expiry.
+     *
+     * @param id Timer ID returned from schedule()
+     * @param delay New delay, from now, from any integer duration
+     * @return true if the timer was found and rescheduled, false otherwise
+     */
+    bool reschedule(TimerId id, std::chrono::steady_clock::duration delay);
+
+    /**
+     * Restart an armed timer with the delay it was scheduled with, see reschedule().
+     * Typically an idle timeout pushed back on every packet.
+     *
+     * @param id Timer ID returned from schedule()
+     * @return true if the timer was found and restarted, false otherwise
+     */
+    bool reset(TimerId id);
+
+    /**
+     * Cancel many timers at once, in a single lock hold with a single wake-up.
+     *
+     * @param ids Range of timer ids
+     * @return Number of timers found and cancelled
+     */
+    template<typename Range>
+    size_t cancel_batch(const Range& ids) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        drain_submissions_(true);
+        size_t cancelled = 0;
+        for (TimerId id : ids) {
+            cancelled += cancel_locked_(id) ? 1 : 0;
+        }
+        return cancelled;
+    }
+
+    /**
+     * Cancel every timer scheduled with the given group tag.
+     *
+     * @param group Group tag passed in TimerOptions, not 0
+     * @return Number of timers found and cancelled
+     */
+    size_t cancel_group(uint64_t group);
+
+    /**
+     * Number of expired callbacks waiting for an executor thread, always 0 without executor.
+     * A steadily growing value means the pool is saturated.
+     */
+    size_t pending_callbacks() const;
+
+    /**
+     * Number of wake-ups saved by slack: timers served by a wake-up that fired an earlier
+     * expiry, which would otherwise have needed their own.
+     */
+    uint64_t wakeups_saved() const { return wakeups_saved_.load(std::memory_order_relaxed); }
+
+    /**
+     * Threadless mode only: timerfd armed to the next expiry, to register with epoll or
+     * io_uring. Becomes readable when process_expired() has work to do. -1 when not
+     * threadless or where timerfd is not available (poll next_expiry() instead).
+     */
+    int fd() const { return timer_fd_; }
+
+    /**
+     * Threadless mode only: fire every timer due at now, on the calling thread, and rearm
+     * fd() to the next expiry.
+     *
+     * @param now Current time
+     * @return Number of callbacks fired (or handed to the executor pool)
+     */
+    size_t process_expired(std::chrono::steady_clock::time_point now);
+    size_t process_expired() { return process_expired(now()); }
+
+    /**
+     * Current time of the service clock: steady_clock, or the virtual time with manual_clock
+     */
+    std::chrono::steady_clock::time_point now() const {
+        return manual_clock_ ? TimePoint(TimePoint::duration(manual_now_.load(std::memory_order_acquire)))
+                             : std::chrono::steady_clock::now();
+    }
+
+    /**
+     * Manual clock only: move the virtual clock forward to the given time, firing every timer
+     * due until then synchronously on the calling thread, in expiry order, with now()
+     * reading each expiry as it fires. Repeating timers fire once per period passed.
+     * No-op for a time not after now().
+     *
+     * @return Number of callbacks fired
+     */
+    size_t advance_to(std::chrono::steady_clock::time_point time);
+
+    /**
+     * Manual clock only: advance_to(now() + duration)
+     */
+    template<typename Rep, typename Period>
+    size_t advance(std::chrono::duration<Rep, Period> duration) {
+        return advance_to(now() + std::chrono::duration_cast<TimePoint::duration>(duration));
+    }
+
+    /**
+     * Point in time the next timer is due at, time_point::max() if none is armed. For a
+     * threadless host loop without timerfd, as its poll timeout.
+     */
+    std::chrono::steady_clock::time_point next_expiry() const;
+
+    /**
+     * Counters and latency histograms, only the queue depth unless
+     * TimerServiceConfig::collect_stats is set. Cheap enough to be polled by a metrics exporter.
+     */
+    TimerServiceStats stats() const;
+
+    /**
+     * Memory held for the armed timers, by component. Walks the timer table, meant for
+     * capacity planning rather than frequent polling.
+     */
+    TimerServiceMemory memory_usage() const;
+
+    /**
+     * Save the armed persistent timers to a file, see write_timer_snapshot(), with their
+     * expiry converted to wall clock time. Timers are copied out under the service lock, in
+     * a single pass, and written once it is released. A repeating timer whose callback is
+     * running is saved with its next repetition.
+     *
+     * @param path File to write, replaced atomically
+     * @return Number of timers saved
+     * @throws std::runtime_error if the file cannot be written
+     */
+    size_t snapshot(const std::string& path);
+
+    /**
+     * Arm the timers of a snapshot in a single lock hold with a single wake-up, at the wall
+     * clock expiry they were saved with: timers that came due while the process was down
+     * fire at once. Timers whose handler key is not registered any more are skipped.
+     *
+     * @param path File written by snapshot()
+     * @param handlers Registry to find the handlers in, must outlive the restored timers
+     * @return Number of timers armed
+     * @throws std::runtime_error if the file cannot be read or is not a valid snapshot
+     */
+    size_t restore(const std::string& path, const TimerHandlerRegistry& handlers);
+
 private:
     using TimePoint = std::chrono::steady_clock::time_point;
 
-    struct TimerData {
-        TimerId id;
-        std::function<void()> callback;
-        int repeat;
-        std::chrono::milliseconds period;
+    // Instrumentation, allocated when enabled. Counters are guarded by mutex_, the histograms
+    // are recorded from whichever thread runs the callbacks.
+    struct Stats {
+        size_t max_queue_depth = 0;
+        uint64_t scheduled = 0;
+        uint64_t cancelled = 0;
+        uint64_t periods_skipped = 0;
+        size_t max_backlog = 0;
+        uint64_t shed = 0;
+        LatencyHistogram lateness;
+        LatencyHistogram callback_time;
     };
 
+    // schedule() or cancel() handed to the worker in lock-free submission mode
+    struct Command {
+        TimePoint expiry;
+        TimerData data;      // Only the id is set for a cancellation
+        bool cancel;
+        uint64_t serial_key; // Go to the TimerExtra of the timer, if any
+        uint64_t group;
+        const PersistentTimer* persistent;
+    };
+
+    // Timer taken out of the queue by the worker, with the expiry it fired for
+    struct Expired {
+        TimerData* data;
+        TimePoint expiry;
+    };
+
+    // Values of sleep_until_ besides the deadline the worker sleeps on
+    static constexpr TimePoint::rep kAwake = std::numeric_limits<TimePoint::rep>::min();
+    static constexpr TimePoint::rep kIdle = std::numeric_limits<TimePoint::rep>::max();
+
+    /**
+     * Create a type-erased wrapper that captures both callback and argument.
+     * The argument is copied here, so caller doesn't need to preserve it.
+     */
+    template<typename Func, typename Arg>
+    static TimerCallback make_callback_(Func&& callback, Arg&& arg) {
+        return [callback = std::forward<Func>(callback), arg = std::forward<Arg>(arg)]() mutable {
+            callback(arg);
+        };
+    }
+
+    /**
+     * Slack of a new timer: the larger of the option and the default, clamped to the about
+     * 24.8 days TimerData holds rather than wrapping
+     */
+    decltype(TimerData::slack) slack_(const TimerOptions& options) const {
+        return decltype(TimerData::slack)(std::min<std::chrono::milliseconds::rep>(
+            std::max(options.slack, default_slack_).count(), std::numeric_limits<int32_t>::max()));
+    }
+
+    /**
+     * Run a schedule_future() callback and settle its promise with the outcome
+     */
+    template<typename Result, typename Func, typename Arg>
+    static void fulfil_(std::promise<Result>& promise, Func& callback, Arg& arg) {
+        try {
+            promise.set_value(callback(arg));
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    template<typename Func, typename Arg>
+    static void fulfil_(std::promise<void>& promise, Func& callback, Arg& arg) {
+        try {
+            callback(arg);
+            promise.set_value();
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    /**
+     * Build a persistent timer, whose callback owns its PersistentTimer
+     *
+     * @param persistent Set to the PersistentTimer of the timer
+     */
+    TimerData make_persistent_(const TimerHandler& handler, std::string&& payload, TimePoint::duration period,
+                               int repeat, const TimerOptions& options, const PersistentTimer*& persistent);
+
+    /**
+     * Arm a built timer, through the submission queue if enabled
+     */
+    TimerId submit_(TimePoint expiry, TimerData&& data, const TimerOptions& options,
+                    const PersistentTimer* persistent = nullptr);
+
+    /**
+     * Arm many built timers under the service lock
+     */
+    std::vector<TimerId> submit_batch_(std::vector<Command>&& commands);
+
+    void link_group_(TimerData* data);
+    void unlink_group_(TimerData* data);
+
+    /**
+     * Cancel a timer, mutex_ must be held
+     *
+     * @return true if the timer was found and cancelled
+     */
+    bool cancel_locked_(TimerId id);
+
+    /**
+     * Destroy a timer and give back its id and side record, mutex_ must be held
+     *
+     * @param queued Whether the timer is still in the queue ordering, or detached
+     */
+    void drop_(TimerData* data, bool queued);
+
+    /**
+     * Reclaim a lazily cancelled timer, mutex_ must be held
+     *
+     * @param queued Whether the timer is still in the queue ordering, or detached
+     */
+    void discard_(TimerData* data, bool queued);
+
+    /**
+     * Drop every queued dead timer, mutex_ must be held
+     */
+    void compact_();
+
+    /**
+     * Move a timer to a new expiry, mutex_ must be held
+     *
+     * @param delay New delay, negative to use the delay the timer was scheduled with
+     */
+    bool reschedule_locked_(TimerId id, TimePoint::duration delay);
+
+    /**
+     * Whether the callback of a timer is running or about to, mutex_ must be held
+     */
+    bool in_flight_(TimerId id) const;
+
+    /**
+     * ShutdownPolicy::Flush: fire every armed timer once, mutex_ must be held
+     */
+    void flush_(std::unique_lock<std::mutex>& lock);
+
+    /**
+     * Apply the pending submitted commands, mutex_ must be held
+     *
+     * @param all Also wait for the commands claimed but not yet published by producers,
+     * so that a command applied next is ordered after every earlier submission
+     */
+    void drain_submissions_(bool all = false);
+
+    /**
+     * Wait for a notification or the given deadline, TimePoint::max() to wait without deadline
+     */
+    void sleep_(std::unique_lock<std::mutex>& lock, TimePoint deadline);
+
+    /**
+     * Precise mode: busy-wait with the lock released until the deadline, or until a
+     * producer arms an earlier timer
+     */
+    void spin_(std::unique_lock<std::mutex>& lock, TimePoint deadline);
+
+    /**
+     * Tell the worker, or the host loop in threadless mode, that the next expiry may have
+     * moved earlier. The worker is only notified when that expiry is before the deadline it
+     * sleeps on, and after the lock is released.
+     *
+     * @param lock Holding mutex_, released on return
+     */
+    void wake_(std::unique_lock<std::mutex>& lock);
+
+    /**
+     * Threadless mode: arm the timer fd to the next expiry, mutex_ must be held
+     */
+    void arm_timer_fd_();
+
     /**
      * Worker thread that processes expired timers
      */
     void worker_();
 
     /**
-     * Schedule a timer to an expiry date
+     * Apply pending submissions and compact tombstones before serving the queue, mutex_ must be held
+     */
+    void prepare_();
+
+    /**
+     * Detach the timers due at now into batch_, mutex_ must be held
+     *
+     * @return true if any timer is due
+     */
+    bool collect_expired_(TimePoint now);
+
+    /**
+     * Order batch_ by priority, keeping expiry order within a class
+     */
+    void prioritize_();
+
+    /**
+     * Worker loop body with a fire limit: move the expired timers to the backlog, fire what
+     * the budget of the interval allows, by priority, then sleep
+     */
+    void serve_limited_(std::unique_lock<std::mutex>& lock);
+
+    /**
+     * Fill batch_ from the backlog, by priority, within the budget of the interval
+     */
+    void take_backlog_(TimePoint now);
+
+    /**
+     * Drop a late best effort timer without running its callback, mutex_ must be held
+     */
+    void shed_(TimerData* data);
+
+    /**
+     * Whether a best effort timer is late enough past its expiry to be shed
+     */
+    bool sheddable_(const TimerData* data, TimePoint expiry, TimePoint now) const;
+
+    /**
+     * Fire batch_ with the lock released, then rearm or release its timers
+     */
+    void run_batch_(std::unique_lock<std::mutex>& lock);
+
+    /**
+     * Run the callback of an expired timer, recording its lateness and duration if enabled
+     */
+    void fire_(TimerData* data, TimePoint expiry);
+
+    /**
+     * Rearm or release a timer whose callback has run, mutex_ must be held
+     *
+     * @param data Detached timer
+     * @param collapse Skip the missed periods of a repeating timer whatever its policy
+     */
+    void finish_fire_(TimerData* data, bool collapse = false);
+
+    /**
+     * Restart the periodic schedule of a timer from a new expiry
+     */
+    static void restart_period_(TimerData* data, TimePoint expiry);
+
+    /**
+     * Schedule a timer to an expiry date, mutex_ must be held
      *
      * @param expiry Expiry date of the time
      * @param data Already built timer
+     * @param serial_key Serial key of the timer, stored with group in its TimerExtra
+     * @param group Group tag of the timer
+     * @param persistent Handler and argument of a persistent timer, owned by its callback
      * @return TimerId that can be used to cancel the timer
      * */
-    TimerId schedule_until(std::chrono::steady_clock::time_point expiry, TimerData&& data);
+    TimerId schedule_until(std::chrono::steady_clock::time_point expiry, TimerData&& data,
+                           uint64_t serial_key = 0, uint64_t group = 0, const PersistentTimer* persistent = nullptr);
 
     std::thread worker_thread_;
     mutable std::mutex mutex_;
     std::condition_variable cv_;
-    std::multimap<TimePoint, TimerData> timers_; // Ordered by expiration time
+    std::unique_ptr<TimerQueue> queue_; // Armed timers ordered by expiration time
+    TimerSlots slots_;                  // Timer id to its timer, queued or detached
+    std::unique_ptr<CallbackExecutor> executor_; // Runs the callbacks, null to run them on worker_thread_
+    NodePool extra_pool_;               // TimerExtra records, guarded by mutex_
+    NodePool group_pool_;
+    std::unordered_map<uint64_t, TimerData*, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                       PoolAllocator<std::pair<const uint64_t, TimerData*>>> groups_; // Group tag to its first timer
+    const std::chrono::milliseconds default_slack_;
+    const size_t max_batch_;
+    const bool lazy_cancel_;
+    const bool precise_;
+    const TimePoint::duration spin_threshold_;
+    const size_t fire_limit_;
+    const TimePoint::duration fire_interval_;
+    const TimePoint::duration shed_lateness_;
+    TimePoint window_end_{};  // Worker only, end of the current fire limit interval
+    size_t window_fired_ = 0; // Worker only, callbacks fired in the current interval
+    bool mixed_priorities_ = false; // Worker only, whether batch_ holds several classes
+    std::deque<Expired> backlog_[3]; // Expired timers held back by the fire limit, per TimerPriority
+    size_t backlog_size_ = 0;
+    const double compaction_threshold_;
+    std::vector<Expired> batch_; // Worker only, reused across wake-ups
+    std::vector<TimerData*> compacted_; // Worker only, reused across compactions
+    std::vector<Expired> ordered_; // Worker only, reused by prioritize_()
+    std::atomic<size_t> tombstones_{0};
+    std::unique_ptr<BoundedMpscQueue<Command>> submissions_; // Null unless lock-free submission
+    std::atomic<TimePoint::rep> sleep_until_; // Deadline the worker sleeps on, kAwake or kIdle.
+                                              // Written under mutex_, read without it by lock-free producers
+    std::atomic<uint64_t> wakeups_saved_{0};
+    std::unique_ptr<Stats> stats_; // Null unless collect_stats
+    const bool manual_clock_;
+    std::atomic<TimePoint::rep> manual_now_; // Virtual time with manual_clock_
+    const bool threadless_;
+    const int timer_fd_;           // Threadless mode only, -1 otherwise
+    TimePoint fd_deadline_ = TimePoint::max(); // Deadline timer_fd_ is armed to
     std::atomic<bool> running_;
-    std::atomic<TimerId> next_id_;
+    const ShutdownPolicy shutdown_policy_;
+    bool stopping_ = false;       // Guarded by mutex_, set by the first shutdown() call
+    bool stopped_ = false;        // Guarded by mutex_, set once shutdown() is done
+    std::condition_variable fire_cv_; // Signals cancel_and_wait() callers as callbacks return
+    size_t fire_waiters_ = 0;     // Guarded by mutex_
+};
+
+#ifdef TIMER_SERVICE_COROUTINES
+/**
+ * Awaiter returned by TimerService::sleep_for()
+ */
+class TimerService::SleepAwaiter {
+public:
+    SleepAwaiter(TimerService& service, TimePoint::duration delay, const TimerOptions& options)
+        : service_(service), delay_(delay), options_(options) {}
+
+    bool await_ready() const noexcept { return delay_ <= TimePoint::duration::zero(); }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // The worker may resume the coroutine before schedule() returns, touch nothing after
+        service_.schedule(delay_, [](std::coroutine_handle<>& coroutine) { coroutine.resume(); }, handle, 0, options_);
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    TimerService& service_;
+    TimePoint::duration delay_;
+    TimerOptions options_;
+};
+
+template<typename Rep, typename Period>
+TimerService::SleepAwaiter TimerService::sleep_for(std::chrono::duration<Rep, Period> delay,
+                                                   const TimerOptions& options) {
+    return SleepAwaiter(*this, std::chrono::duration_cast<TimePoint::duration>(delay), options);
+}
+
+/**
+ * Awaiter returned by TimerService::with_timeout(). The operation is awaited by a detached
+ * relay coroutine racing the timer, the first to claim the shared state resumes the awaiting
+ * coroutine, the relay cancelling the timer when it wins.
+ */
+template<typename Awaitable>
+class TimerService::TimeoutAwaiter {
+    // Awaiter of the operation: its member operator co_await if any, the operation otherwise
+    template<typename T>
+    static auto awaiter_(T&& awaitable, int) -> decltype(std::forward<T>(awaitable).operator co_await()) {
+        return std::forward<T>(awaitable).operator co_await();
+    }
+    template<typename T>
+    static T&& awaiter_(T&& awaitable, long) {
+        return std::forward<T>(awaitable);
+    }
+
+    using Value = decltype(awaiter_(std::declval<Awaitable>(), 0).await_resume());
+    static constexpr bool kVoid = std::is_void<Value>::value;
+    using Result = std::conditional_t<kVoid, bool, std::optional<std::decay_t<Value>>>;
+
+    struct State {
+        explicit State(Awaitable&& operation) : operation(std::move(operation)) {}
+        explicit State(const Awaitable& operation) : operation(operation) {}
+
+        Awaitable operation;
+        std::atomic<bool> claimed{false};
+        std::coroutine_handle<> waiter;
+        std::atomic<TimerId> timer{0};
+        Result result{};          // Written by the relay once it claimed the state
+        std::exception_ptr error;
+    };
+
+    // Coroutine type of the relay, runs eagerly and frees its frame when done
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    static Detached relay_(TimerService& service, std::shared_ptr<State> state) {
+        Result result{};
+        std::exception_ptr error;
+        try {
+            if constexpr (kVoid) {
+                co_await std::move(state->operation);
+                result = true;
+            } else {
+                result.emplace(co_await std::move(state->operation));
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (state->claimed.exchange(true, std::memory_order_acq_rel)) {
+            co_return; // Timed out, the awaiting coroutine already resumed
+        }
+        service.cancel(state->timer.load(std::memory_order_acquire));
+        state->result = std::move(result);
+        state->error = error;
+        state->waiter.resume();
+    }
+
+public:
+    template<typename Operation>
+    TimeoutAwaiter(TimerService& service, Operation&& operation, TimePoint::duration delay)
+        : service_(service), state_(std::make_shared<State>(std::forward<Operation>(operation))), delay_(delay) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // Either side may resume the coroutine, and destroy this awaiter, before we return
+        TimerService& service = service_;
+        std::shared_ptr<State> state = state_;
+        state->waiter = handle;
+        auto expire = [](std::shared_ptr<State>& state) {
+            if (!state->claimed.exchange(true, std::memory_order_acq_rel)) {
+                state->waiter.resume();
+            }
+        };
+        // Armed before the relay starts, so that the relay always has an id to cancel
+        state->timer.store(service.schedule(delay_, expire, state), std::memory_order_release);
+        relay_(service, std::move(state));
+    }
+
+    Result await_resume() {
+        if (state_->error) {
+            std::rethrow_exception(state_->error);
+        }
+        return std::move(state_->result);
+    }
+
+private:
+    TimerService& service_;
+    std::shared_ptr<State> state_;
+    TimePoint::duration delay_;
 };
+#endif
@@ -0,0 +1,154 @@
+#include "timer_slots.h"
+
+#include <stdexcept>
+
+constexpr unsigned TimerSlots::kIndexBits;
+constexpr unsigned TimerSlots::kGenerationBits;
+constexpr unsigned TimerSlots::kIdBits;
+constexpr unsigned TimerSlots::kFirstChunkBits;
+constexpr unsigned TimerSlots::kMaxChunks;
+constexpr uint32_t TimerSlots::kNone;
+constexpr uint32_t TimerSlots::kGenerationMask;
+constexpr uint32_t TimerSlots::kDead;
+
+TimerSlots::TimerSlots(size_t reserve) : capacity_(0), free_(kNone) {
+    for (auto& chunk : chunks_) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+    while (capacity_.load(std::memory_order_relaxed) < reserve) {
+        add_chunk_();
+    }
+}
+
+TimerSlots::~TimerSlots() {
+    for (auto& chunk : chunks_) {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+}
+
+TimerSlots::Slot& TimerSlots::slot_(uint32_t index) const {
+    // Chunk k holds 2^(kFirstChunkBits + k) slots and starts at 2^kFirstChunkBits * (2^k - 1)
+    uint64_t scaled = (uint64_t(index) >> kFirstChunkBits) + 1;
+    unsigned chunk = 63 - unsigned(__builtin_clzll(scaled));
+    uint64_t offset = uint64_t(index) - (((uint64_t(1) << chunk) - 1) << kFirstChunkBits);
+    return chunks_[chunk].load(std::memory_order_acquire)[offset];
+}
+
+const TimerSlots::Slot* TimerSlots::lookup_(Id id) const {
+    if ((id >> kIdBits) != 0) {
+        return nullptr;
+    }
+    uint32_t index = uint32_t(id);
+    if (index >= capacity_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    uint32_t generation = uint32_t(id >> kIndexBits);
+    if (generation == 0) {
+        return nullptr; // Never handed out, the generation of retired slots
+    }
+    const Slot& slot = slot_(index);
+    if (slot.generation.load(std::memory_order_acquire) != generation) {
+        return nullptr;
+    }
+    return &slot;
+}
+
+TimerSlots::Id TimerSlots::acquire() {
+    uint64_t head = free_.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t index = uint32_t(head);
+        if (index == kNone) {
+            grow_();
+            head = free_.load(std::memory_order_acquire);
+            continue;
+        }
+        Slot& slot = slot_(index);
+        uint64_t next = (((head >> 32) + 1) << 32) | slot.next_free.load(std::memory_order_relaxed);
+        if (free_.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return encode_(index, slot.generation.load(std::memory_order_relaxed));
+        }
+    }
+}
+
+void TimerSlots::bind(Id id, TimerData* data) {
+    slot_(uint32_t(id)).data = data;
+}
+
+TimerData* TimerSlots::find(Id id) const {
+    const Slot* slot = lookup_(id);
+    return slot ? slot->data : nullptr;
+}
+
+bool TimerSlots::live(Id id) const {
+    return lookup_(id) != nullptr;
+}
+
+void TimerSlots::release(Id id) {
+    uint32_t index = uint32_t(id);
+    Slot& slot = slot_(index);
+    slot.data = nullptr;
+    uint32_t generation = ((slot.generation.load(std::memory_order_relaxed) & kGenerationMask) + 1) & kGenerationMask;
+    if (generation == 0) {
+        // Wrapping would hand out the ids of the slot again, retire it instead: generation 0
+        // is never handed out, so no id matches it anymore
+        slot.generation.store(0, std::memory_order_release);
+        return;
+    }
+    slot.generation.store(generation, std::memory_order_release);
+    push_free_(index, slot);
+}
+
+bool TimerSlots::kill(Id id) {
+    const Slot* slot = lookup_(id);
+    if (!slot) {
+        return false;
+    }
+    uint32_t generation = uint32_t(id >> kIndexBits);
+    return const_cast<Slot*>(slot)->generation.compare_exchange_strong(
+        generation, generation | kDead, std::memory_order_acq_rel, std::memory_order_relaxed);
+}
+
+bool TimerSlots::dead(Id id) const {
+    return slot_(uint32_t(id)).generation.load(std::memory_order_acquire) == (uint32_t(id >> kIndexBits) | kDead);
+}
+
+TimerData* TimerSlots::bound(Id id) const {
+    if (TimerData* data = find(id)) {
+        return data;
+    }
+    return uint32_t(id) < capacity() && dead(id) ? slot_(uint32_t(id)).data : nullptr;
+}
+
+void TimerSlots::push_free_(uint32_t first, Slot& last) {
+    uint64_t head = free_.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        last.next_free.store(uint32_t(head), std::memory_order_relaxed);
+        next = (((head >> 32) + 1) << 32) | first;
+    } while (!free_.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void TimerSlots::grow_() {
+    std::lock_guard<std::mutex> lock(grow_mutex_);
+    if (uint32_t(free_.load(std::memory_order_acquire)) != kNone) {
+        return; // Grown or released meanwhile
+    }
+    add_chunk_();
+}
+
+void TimerSlots::add_chunk_() {
+    if (chunk_count_ == kMaxChunks) {
+        throw std::length_error("TimerSlots: too many armed timers");
+    }
+    size_t size = size_t(1) << (kFirstChunkBits + chunk_count_);
+    uint32_t base = uint32_t(capacity_.load(std::memory_order_relaxed));
+    Slot* chunk = new Slot[size];
+    for (size_t i = 0; i < size; ++i) {
+        chunk[i].generation.store(1, std::memory_order_relaxed);
+        chunk[i].next_free.store(uint32_t(base + i + 1), std::memory_order_relaxed);
+        chunk[i].data = nullptr;
+    }
+    chunks_[chunk_count_++].store(chunk, std::memory_order_release);
+    capacity_.store(base + size, std::memory_order_release);
+    push_free_(base, chunk[size - 1]);
+}
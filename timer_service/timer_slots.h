@@ -0,0 +1,152 @@
+#pragma once
+
+#include "timer_queue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Table of generation-tagged timer handles.
+ *
+ * A timer id is the index of a slot in the low 32 bits and the generation of that slot in
+ * the next kGenerationBits bits. Releasing a slot bumps its generation, so the ids of fired
+ * or cancelled timers stop matching at once, without tombstones nor a map to clean up.
+ * Looking a timer up is an array access and a compare. A slot whose generation would wrap is
+ * retired rather than reused, so a stale id never matches again: one slot lost every 2^24
+ * reuses of it.
+ *
+ * Slots live in chunks of doubling size that never move. acquire() and live() are lock-free
+ * and can be called from any thread, so that ids are handed out before the owner lock is
+ * taken. bind(), find(), release() and for_each() must be serialised by the owner.
+ */
+class TimerSlots {
+public:
+    using Id = TimerData::Id;
+
+    static constexpr unsigned kIndexBits = 32;
+    static constexpr unsigned kGenerationBits = 24;
+    static constexpr unsigned kIdBits = kIndexBits + kGenerationBits;
+
+    /**
+     * @param reserve Number of slots allocated up front
+     */
+    explicit TimerSlots(size_t reserve = 0);
+    ~TimerSlots();
+
+    TimerSlots(const TimerSlots&) = delete;
+    TimerSlots& operator=(const TimerSlots&) = delete;
+
+    /**
+     * Take a free slot, growing the table if none is left
+     *
+     * @return Id of the slot, never 0
+     */
+    Id acquire();
+
+    /**
+     * Attach the stored timer to an acquired slot
+     */
+    void bind(Id id, TimerData* data);
+
+    /**
+     * @return the timer bound to a live id, nullptr for a stale, unbound or invalid id
+     */
+    TimerData* find(Id id) const;
+
+    /**
+     * Whether the id was acquired and not released yet, thread safe
+     */
+    bool live(Id id) const;
+
+    /**
+     * Give back the slot of a live or killed id, stale ids of it stop matching. The slot is
+     * retired rather than freed once its generation is exhausted.
+     */
+    void release(Id id);
+
+    /**
+     * Tombstone a live id without the owner lock: it stops matching like a released one,
+     * while the slot stays bound until the owner releases it. Thread safe.
+     *
+     * @return true if the id was live
+     */
+    bool kill(Id id);
+
+    /**
+     * Whether the slot of the id was killed and not released since
+     */
+    bool dead(Id id) const;
+
+    /**
+     * @return the timer bound to a live or killed id, nullptr otherwise
+     */
+    TimerData* bound(Id id) const;
+
+    /**
+     * Call f on every bound timer
+     */
+    template<typename Func>
+    void for_each(Func&& f) const {
+        size_t capacity = capacity_.load(std::memory_order_acquire);
+        for (size_t index = 0; index < capacity; ++index) {
+            TimerData* data = slot_(uint32_t(index)).data;
+            if (data) {
+                f(data);
+            }
+        }
+    }
+
+    size_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+
+    /**
+     * Bytes allocated for slots, free ones included
+     */
+    size_t memory_usage() const { return capacity() * sizeof(Slot); }
+
+private:
+    static constexpr unsigned kFirstChunkBits = 6;
+    static constexpr unsigned kMaxChunks = kIndexBits - kFirstChunkBits;
+    static constexpr uint32_t kNone = UINT32_MAX;
+    static constexpr uint32_t kGenerationMask = (uint32_t(1) << kGenerationBits) - 1;
+    static constexpr uint32_t kDead = uint32_t(1) << 31; // Tombstone bit of a slot generation
+
+    struct Slot {
+        std::atomic<uint32_t> generation;
+        std::atomic<uint32_t> next_free;  // Next slot of the free stack
+        TimerData* data;                  // Guarded by the owner
+    };
+
+    static Id encode_(uint32_t index, uint32_t generation) {
+        return (Id(generation) << kIndexBits) | index;
+    }
+
+    /**
+     * Slot of an id, nullptr if out of range
+     */
+    const Slot* lookup_(Id id) const;
+
+    Slot& slot_(uint32_t index) const;
+
+    /**
+     * Push a chain of free slots, linked through next_free, on the free stack
+     */
+    void push_free_(uint32_t first, Slot& last);
+
+    /**
+     * Add a chunk if the free stack is still empty once grow_mutex_ is taken
+     */
+    void grow_();
+
+    /**
+     * Allocate the next chunk and push its slots on the free stack, under grow_mutex_ once constructed
+     */
+    void add_chunk_();
+
+    std::atomic<Slot*> chunks_[kMaxChunks];
+    std::atomic<size_t> capacity_;
+    std::atomic<uint64_t> free_;  // Free stack head: ABA tag in the high half, slot index in the low one
+    std::mutex grow_mutex_;
+    unsigned chunk_count_ = 0;    // Guarded by grow_mutex_
+};
@@ -0,0 +1,292 @@
+#include "timer_snapshot.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'M', 'R', 'S', 'N', 'A', 'P', 0};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kByteOrder = 0x01020304; // Reads back swapped on a host of the other order
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t keys;    // Entries of the key table, each a uint64_t size and the key, padded
+    uint64_t records; // Records after the key table
+};
+
+struct Record {
+    int64_t expiry; // Nanoseconds since the system_clock epoch
+    int64_t period; // Nanoseconds
+    uint64_t serial_key;
+    uint64_t group;
+    int32_t repeat;
+    int32_t slack;  // Milliseconds
+    uint32_t key;   // Index in the key table
+    uint32_t payload_size; // Bytes of payload after the record, padded
+    uint8_t catch_up;
+    uint8_t priority;
+    uint8_t reserved[6];
+};
+
+static_assert(sizeof(Header) % 8 == 0 && sizeof(Record) % 8 == 0, "Snapshot entries keep 8 byte alignment");
+
+size_t padded(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+void append(std::string& out, const void* data, size_t size) {
+    out.append(static_cast<const char*>(data), size);
+    out.append(padded(size) - size, '\0');
+}
+
+#ifdef __linux__
+/**
+ * Write data to a new file and flush it to the device, false on error
+ */
+bool write_durably(const std::string& path, const std::string& data) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const char* from = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, from, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::close(fd);
+            return false;
+        }
+        from += written;
+        left -= size_t(written);
+    }
+    bool synced = ::fsync(fd) == 0;
+    return ::close(fd) == 0 && synced;
+}
+
+/**
+ * Flush the entry of a renamed file, the rename is only durable once its directory is
+ */
+void sync_directory(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+#endif
+
+void corrupt(const std::string& path) {
+    throw std::runtime_error("TimerService: invalid snapshot " + path);
+}
+
+/**
+ * Cursor over the bytes of a snapshot, every read is bounds checked
+ */
+class Reader {
+public:
+    Reader(const char* data, size_t size, const std::string& path) : data_(data), left_(size), path_(path) {}
+
+    void read(void* out, size_t size) {
+        const char* from = take_(size);
+        std::memcpy(out, from, size);
+    }
+
+    void read(std::string& out, size_t size) {
+        const char* from = take_(size);
+        out.assign(from, size);
+    }
+
+private:
+    const char* take_(size_t size) {
+        // Size first, padding a corrupt length near SIZE_MAX wraps around
+        if (size > left_ || padded(size) > left_) {
+            corrupt(path_);
+        }
+        const char* from = data_;
+        data_ += padded(size);
+        left_ -= padded(size);
+        return from;
+    }
+
+    const char* data_;
+    size_t left_;
+    const std::string& path_;
+};
+
+std::vector<TimerSnapshotRecord> parse(const char* data, size_t size, const std::string& path) {
+    Reader reader(data, size, path);
+    Header header;
+    reader.read(&header, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.byte_order != kByteOrder) {
+        corrupt(path);
+    }
+    // Every entry takes at least 8 bytes, which bounds the counts before reserving
+    if (header.keys > size / 8 || header.records > size / sizeof(Record)) {
+        corrupt(path);
+    }
+    std::vector<std::string> keys(size_t(header.keys));
+    for (std::string& key : keys) {
+        uint64_t length;
+        reader.read(&length, sizeof(length));
+        reader.read(key, size_t(length));
+    }
+
+    std::vector<TimerSnapshotRecord> records(size_t(header.records));
+    for (TimerSnapshotRecord& record : records) {
+        Record entry;
+        reader.read(&entry, sizeof(entry));
+        if (entry.key >= keys.size() || entry.catch_up > uint8_t(CatchUpPolicy::Skip) ||
+            entry.priority > uint8_t(TimerPriority::BestEffort)) {
+            corrupt(path);
+        }
+        record.expiry = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds(entry.expiry)));
+        record.period = std::chrono::nanoseconds(entry.period);
+        record.repeat = entry.repeat;
+        record.slack = std::chrono::milliseconds(entry.slack);
+        record.catch_up = CatchUpPolicy(entry.catch_up);
+        record.priority = TimerPriority(entry.priority);
+        record.serial_key = entry.serial_key;
+        record.group = entry.group;
+        record.key = keys[entry.key];
+        reader.read(record.payload, entry.payload_size);
+    }
+    return records;
+}
+
+} // namespace
+
+const TimerHandler& TimerHandlerRegistry::add(const std::string& key,
+                                              std::function<void(const std::string& payload)> handler) {
+    auto inserted = handlers_.emplace(key, TimerHandler{key, std::move(handler)});
+    if (!inserted.second) {
+        throw std::invalid_argument("TimerHandlerRegistry: duplicate key " + key);
+    }
+    return inserted.first->second;
+}
+
+const TimerHandler* TimerHandlerRegistry::find(const std::string& key) const {
+    auto it = handlers_.find(key);
+    return it != handlers_.end() ? &it->second : nullptr;
+}
+
+void write_timer_snapshot(const std::string& path, const std::vector<TimerSnapshotRecord>& records) {
+    // Keys are stored once, the records refer to them by index
+    std::unordered_map<std::string, uint32_t> indexes;
+    std::vector<const std::string*> keys;
+    for (const TimerSnapshotRecord& record : records) {
+        if (indexes.emplace(record.key, uint32_t(keys.size())).second) {
+            keys.push_back(&record.key);
+        }
+    }
+
+    std::string out;
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byte_order = kByteOrder;
+    header.keys = keys.size();
+    header.records = records.size();
+    append(out, &header, sizeof(header));
+    for (const std::string* key : keys) {
+        uint64_t length = key->size();
+        append(out, &length, sizeof(length));
+        append(out, key->data(), key->size());
+    }
+    for (const TimerSnapshotRecord& record : records) {
+        Record entry{};
+        entry.expiry = int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(record.expiry.time_since_epoch()).count());
+        entry.period = int64_t(record.period.count());
+        entry.serial_key = record.serial_key;
+        entry.group = record.group;
+        entry.repeat = record.repeat;
+        entry.slack = int32_t(record.slack.count());
+        entry.key = indexes[record.key];
+        entry.payload_size = uint32_t(record.payload.size());
+        entry.catch_up = uint8_t(record.catch_up);
+        entry.priority = uint8_t(record.priority);
+        append(out, &entry, sizeof(entry));
+        append(out, record.payload.data(), record.payload.size());
+    }
+
+    std::string temporary = path + ".tmp";
+#ifdef __linux__
+    bool written = write_durably(temporary, out);
+#else
+    bool written;
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), std::streamsize(out.size()));
+        file.flush();
+        written = bool(file);
+    }
+#endif
+    if (!written) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("TimerService: cannot write snapshot " + temporary);
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("TimerService: cannot replace snapshot " + path);
+    }
+#ifdef __linux__
+    sync_directory(path);
+#endif
+}
+
+std::vector<TimerSnapshotRecord> read_timer_snapshot(const std::string& path) {
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 || ::fstat(fd, &status) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("TimerService: cannot read snapshot " + path);
+    }
+    size_t size = size_t(status.st_size);
+    if (size == 0) {
+        ::close(fd);
+        corrupt(path);
+    }
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("TimerService: cannot map snapshot " + path);
+    }
+    try {
+        std::vector<TimerSnapshotRecord> records = parse(static_cast<const char*>(mapped), size, path);
+        ::munmap(mapped, size);
+        return records;
+    } catch (...) {
+        ::munmap(mapped, size);
+        throw;
+    }
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("TimerService: cannot read snapshot " + path);
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return parse(data.data(), data.size(), path);
+#endif
+}
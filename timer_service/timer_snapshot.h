@@ -0,0 +1,136 @@
+#pragma once
+
+#include "timer_queue.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Encoding of the arguments of persistent timers. Trivially copyable types are stored as
+ * their bytes and std::string as it is, specialise it for any other argument type.
+ */
+template<typename T, typename Enable = void>
+struct TimerCodec;
+
+template<typename T>
+struct TimerCodec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+    static void encode(const T& value, std::string& payload) {
+        payload.assign(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static bool decode(const std::string& payload, T& value) {
+        if (payload.size() != sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, payload.data(), sizeof(T));
+        return true;
+    }
+};
+
+template<>
+struct TimerCodec<std::string> {
+    static void encode(const std::string& value, std::string& payload) { payload = value; }
+
+    static bool decode(const std::string& payload, std::string& value) {
+        value = payload;
+        return true;
+    }
+};
+
+/**
+ * Handler of persistent timers, found again by its key when a snapshot is restored.
+ */
+struct TimerHandler {
+    std::string key;
+    std::function<void(const std::string& payload)> call;
+};
+
+/**
+ * Handlers of the persistent timers of an application, by key. The keys are what snapshots
+ * refer to, so they must stay stable across releases. Handlers are registered at startup
+ * and must outlive the services whose timers use them.
+ */
+class TimerHandlerRegistry {
+public:
+    /**
+     * Register a handler called with the encoded argument of the timer.
+     *
+     * @return the handler, to schedule timers with
+     * @throws std::invalid_argument if the key is already registered
+     */
+    const TimerHandler& add(const std::string& key, std::function<void(const std::string& payload)> handler);
+
+    /**
+     * Register a handler called with the argument of the timer decoded by TimerCodec<Arg>,
+     * timers whose payload does not decode are dropped when they fire.
+     */
+    template<typename Arg, typename Func>
+    const TimerHandler& add(const std::string& key, Func handler) {
+        return add(key, [handler](const std::string& payload) mutable {
+            Arg arg{};
+            if (TimerCodec<Arg>::decode(payload, arg)) {
+                handler(arg);
+            }
+        });
+    }
+
+    /**
+     * @return the handler registered with the key, nullptr if none
+     */
+    const TimerHandler* find(const std::string& key) const;
+
+private:
+    std::unordered_map<std::string, TimerHandler> handlers_; // Nodes never move
+};
+
+/**
+ * What an armed persistent timer carries besides its callback: its handler and encoded
+ * argument, for TimerService::snapshot(). Owned by the callback of the timer.
+ */
+struct PersistentTimer {
+    const TimerHandler* handler;
+    std::string payload;
+};
+
+/**
+ * A persistent timer as saved in a snapshot.
+ */
+struct TimerSnapshotRecord {
+    // Wall clock, as steady_clock does not survive a reboot
+    std::chrono::system_clock::time_point expiry;
+    std::chrono::nanoseconds period{0};
+    int repeat = 0;
+    std::chrono::milliseconds slack{0};
+    CatchUpPolicy catch_up = CatchUpPolicy::FireAll;
+    TimerPriority priority = TimerPriority::Normal;
+    uint64_t serial_key = 0;
+    uint64_t group = 0;
+    std::string key;
+    std::string payload;
+};
+
+/**
+ * Write timers to a snapshot file: a header, the table of handler keys, then fixed size
+ * records each followed by its payload, all 8 byte aligned in host byte order so that the
+ * file can be mapped and read in place. The file is written aside, flushed to the device and
+ * renamed over path, so neither a crash nor a power loss leaves a truncated snapshot: path
+ * holds the previous snapshot or the new one. Outside Linux the file is not flushed, and only
+ * a process crash is covered.
+ *
+ * @throws std::runtime_error if the file cannot be written
+ */
+void write_timer_snapshot(const std::string& path, const std::vector<TimerSnapshotRecord>& records);
+
+/**
+ * Read back the timers of a snapshot file, mapping it in memory where possible.
+ *
+ * @throws std::runtime_error if the file cannot be read, or is not a valid snapshot of this
+ * format version and byte order
+ */
+std::vector<TimerSnapshotRecord> read_timer_snapshot(const std::string& path);
@@ -0,0 +1,283 @@
+#include "timer_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+/**
+ * Event slot of a ring, a seqlock: sequence is 0 while the owner writes it, then the index
+ * of the event plus one. Every field is atomic so that concurrent exports are race free.
+ */
+struct Entry {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<int64_t> time{0}; // Nanoseconds of steady_clock
+    std::atomic<uint64_t> timer{0};
+    std::atomic<int64_t> value{0};
+    std::atomic<uint8_t> event{0};
+};
+
+/**
+ * Events of one thread, only that thread writes them. Once the thread exits, the ring keeps
+ * its events for export until another thread takes it over.
+ */
+struct Ring {
+    explicit Ring(size_t capacity) : entries(capacity), mask(capacity - 1) {}
+
+    std::vector<Entry> entries;
+    size_t mask;
+    std::atomic<uint64_t> head{0};  // Events written
+    std::atomic<uint64_t> start{0}; // Events before it were cleared, or belong to a previous owner
+    uint32_t tid = 0;               // Under the registry mutex, as are the fields below
+    std::string name;
+    bool owned = true;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings; // As many as threads ever recorded at once
+    size_t capacity = 16384;
+    uint32_t next_tid = 1;
+};
+
+Registry& registry() {
+    // Never destroyed, threads may still record while statics are torn down
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+thread_local Ring* local_ring = nullptr;
+thread_local bool ring_released = false; // Thread exiting, its ring was handed back
+
+/**
+ * Hands the ring of the thread back to the registry when the thread exits
+ */
+struct RingOwner {
+    ~RingOwner() {
+        if (local_ring) {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            local_ring->owned = false;
+        }
+        local_ring = nullptr;
+        ring_released = true;
+    }
+};
+
+Ring& local() {
+    if (local_ring == nullptr) {
+        Registry& reg = registry();
+        {
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            // Take over the ring of an exited thread, so that thread churn does not grow the registry
+            for (auto& ring : reg.rings) {
+                if (!ring->owned && ring->entries.size() == reg.capacity) {
+                    local_ring = ring.get();
+                    break;
+                }
+            }
+            if (local_ring == nullptr) {
+                reg.rings.emplace_back(new Ring(reg.capacity));
+                local_ring = reg.rings.back().get();
+            }
+            local_ring->owned = true;
+            local_ring->tid = reg.next_tid++;
+            local_ring->name.clear();
+            local_ring->start.store(local_ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        if (!ring_released) {
+            // Unless recording from a thread local destructor run after the owner's, which
+            // keeps the ring it took
+            static thread_local RingOwner owner;
+            (void)owner;
+        }
+    }
+    return *local_ring;
+}
+
+const char* event_name(TimerEvent event) {
+    switch (event) {
+    case TimerEvent::Schedule:
+        return "schedule";
+    case TimerEvent::Reschedule:
+        return "reschedule";
+    case TimerEvent::Cancel:
+        return "cancel";
+    case TimerEvent::FireBegin:
+    case TimerEvent::FireEnd:
+        return "fire";
+    case TimerEvent::Shed:
+        return "shed";
+    }
+    return "unknown";
+}
+
+void write_string(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+} // namespace
+
+std::atomic<uint64_t> TimerTrace::threshold_{UINT64_MAX};
+
+void TimerTrace::set_sampling(double rate) {
+    uint64_t threshold;
+    if (rate >= 1.0) {
+        threshold = UINT64_MAX;
+    } else if (rate <= 0.0) {
+        threshold = 0;
+    } else {
+        threshold = uint64_t(rate * 18446744073709551616.0); // rate * 2^64
+    }
+    threshold_.store(threshold, std::memory_order_relaxed);
+}
+
+void TimerTrace::set_capacity(size_t events) {
+    // Power of two, masking instead of dividing the event index
+    size_t capacity = 16;
+    while (capacity < events) {
+        capacity <<= 1;
+    }
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.capacity = capacity;
+}
+
+void TimerTrace::name_thread(const std::string& name) {
+    Ring& ring = local();
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    ring.name = name;
+}
+
+void TimerTrace::record(TimerEvent event, uint64_t timer, int64_t value) {
+    Ring& ring = local();
+    uint64_t index = ring.head.load(std::memory_order_relaxed);
+    Entry& entry = ring.entries[index & ring.mask];
+    entry.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.time.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch()).count(),
+                     std::memory_order_relaxed);
+    entry.timer.store(timer, std::memory_order_relaxed);
+    entry.value.store(value, std::memory_order_relaxed);
+    entry.event.store(uint8_t(event), std::memory_order_relaxed);
+    entry.sequence.store(index + 1, std::memory_order_release);
+    ring.head.store(index + 1, std::memory_order_release);
+}
+
+size_t TimerTrace::memory_usage() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    size_t bytes = reg.rings.capacity() * sizeof(std::unique_ptr<Ring>);
+    for (auto& ring : reg.rings) {
+        bytes += sizeof(Ring) + ring->entries.capacity() * sizeof(Entry);
+    }
+    return bytes;
+}
+
+void TimerTrace::clear() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& ring : reg.rings) {
+        ring->start.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+size_t TimerTrace::write_chrome_trace(std::ostream& out, uint64_t timer) {
+    // The rings are never freed. Their owner and range are read under the lock: the events a
+    // new owner records past the range are left out rather than credited to the previous one.
+    struct Span {
+        const Ring* ring;
+        std::string name;
+        uint32_t tid;
+        uint64_t begin;
+        uint64_t end;
+    };
+    std::vector<Span> spans;
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (auto& ring : reg.rings) {
+            uint64_t end = ring->head.load(std::memory_order_acquire);
+            uint64_t begin = std::max(ring->start.load(std::memory_order_relaxed),
+                                      end > ring->entries.size() ? end - ring->entries.size() : 0);
+            spans.push_back(Span{ring.get(), ring->name, ring->tid, begin, end});
+        }
+    }
+
+    size_t written = 0;
+    bool first = true;
+    out << "{\"traceEvents\":[";
+    auto separate = [&]() {
+        out << (first ? "\n" : ",\n");
+        first = false;
+    };
+    for (const Span& span : spans) {
+        const Ring& ring = *span.ring;
+        if (!span.name.empty()) {
+            separate();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << span.tid << ",\"args\":{\"name\":";
+            write_string(out, span.name);
+            out << "}}";
+        }
+
+        for (uint64_t index = span.begin; index < span.end; ++index) {
+            const Entry& entry = ring.entries[index & ring.mask];
+            uint64_t sequence = entry.sequence.load(std::memory_order_acquire);
+            int64_t time = entry.time.load(std::memory_order_relaxed);
+            uint64_t id = entry.timer.load(std::memory_order_relaxed);
+            int64_t value = entry.value.load(std::memory_order_relaxed);
+            TimerEvent event = TimerEvent(entry.event.load(std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence != index + 1 || entry.sequence.load(std::memory_order_relaxed) != sequence) {
+                continue; // Overwritten since, the owner lapped the export
+            }
+            if (timer != 0 && id != timer) {
+                continue;
+            }
+
+            separate();
+            out << "{\"name\":\"" << event_name(event) << "\",\"cat\":\"timer\",\"ph\":";
+            switch (event) {
+            case TimerEvent::FireBegin:
+                out << "\"B\"";
+                break;
+            case TimerEvent::FireEnd:
+                out << "\"E\"";
+                break;
+            default:
+                out << "\"i\",\"s\":\"t\"";
+                break;
+            }
+            // Microseconds with the nanoseconds as decimals; ids as strings, JSON numbers
+            // lose precision past 2^53
+            out << ",\"ts\":" << time / 1000 << '.';
+            int64_t nanoseconds = time % 1000;
+            out << char('0' + nanoseconds / 100) << char('0' + nanoseconds / 10 % 10) << char('0' + nanoseconds % 10);
+            out << ",\"pid\":1,\"tid\":" << span.tid << ",\"args\":{\"timer\":\"" << id << '"';
+            if (event == TimerEvent::Schedule || event == TimerEvent::Reschedule) {
+                out << ",\"delay_ns\":" << value;
+            } else if (event == TimerEvent::FireBegin) {
+                out << ",\"lateness_ns\":" << value;
+            }
+            out << "}}";
+            ++written;
+        }
+    }
+    out << "\n]}\n";
+    return written;
+}
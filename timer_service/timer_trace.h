@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * Lifecycle steps of a timer recorded by the tracing hooks.
+ */
+enum class TimerEvent : uint8_t {
+    Schedule,   // Armed, value is the delay in nanoseconds
+    Reschedule, // Moved, value is the new delay in nanoseconds
+    Cancel,
+    FireBegin,  // Callback started, value is its lateness in nanoseconds
+    FireEnd,    // Callback returned
+    Shed,       // Expiry dropped by overload protection
+};
+
+/**
+ * Per-thread trace of timer lifecycle events, exported as Chrome trace JSON (chrome://tracing,
+ * Perfetto).
+ *
+ * Events are only recorded when the library is built with TIMER_SERVICE_TRACING (the CMake
+ * option of the same name), the hooks compile to nothing otherwise. Every thread writes to a
+ * ring buffer of its own, without locks nor contention, overwriting its oldest events. The
+ * exporter reads the rings concurrently and skips the entries being overwritten. The ring of
+ * an exited thread is exported until another thread takes it over.
+ *
+ * Sampling picks timers by a hash of their id, so that a sampled timer is traced through its
+ * whole lifecycle: at 1%, one timer in a hundred, with every step of it.
+ */
+class TimerTrace {
+public:
+    /**
+     * Whether the hooks were compiled in
+     */
+    static constexpr bool enabled() {
+#ifdef TIMER_SERVICE_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Fraction of the timers traced, from 0 (none) to 1 (all, the default)
+     */
+    static void set_sampling(double rate);
+
+    /**
+     * Events kept per thread, applies to the threads that record their first event afterwards
+     */
+    static void set_capacity(size_t events);
+
+    /**
+     * Name the calling thread in exported traces
+     */
+    static void name_thread(const std::string& name);
+
+    /**
+     * Whether the events of a timer are recorded at the current sampling rate
+     */
+    static bool sampled(uint64_t timer) {
+        uint64_t threshold = threshold_.load(std::memory_order_relaxed);
+        return threshold == UINT64_MAX || ((timer ^ (timer >> 32)) * 0x9E3779B97F4A7C15ull) < threshold;
+    }
+
+    /**
+     * Record an event of the calling thread, whether the timer is sampled or not. The hooks
+     * test sampled() first, so that the value of an unsampled timer is not even computed.
+     */
+    static void record(TimerEvent event, uint64_t timer, int64_t value = 0);
+
+    /**
+     * Bytes held by the rings. A thread that exits hands its ring over to the next thread
+     * that records, so this grows with the threads recording at once, not with thread churn.
+     */
+    static size_t memory_usage();
+
+    /**
+     * Forget the events recorded so far
+     */
+    static void clear();
+
+    /**
+     * Write the events held by every thread as Chrome trace JSON
+     *
+     * @param out Stream to write to
+     * @param timer Only the events of this timer, 0 for all
+     * @return Number of events written
+     */
+    static size_t write_chrome_trace(std::ostream& out, uint64_t timer = 0);
+
+private:
+    static std::atomic<uint64_t> threshold_;
+};
+
+#ifdef TIMER_SERVICE_TRACING
+#define TIMER_SERVICE_TRACE(event, timer, value)                                 \
+    do {                                                                         \
+        if (TimerTrace::sampled(timer)) {                                        \
+            TimerTrace::record(TimerEvent::event, (timer), (value));             \
+        }                                                                        \
+    } while (0)
+#define TIMER_SERVICE_TRACE_THREAD(name) TimerTrace::name_thread(name)
+#else
+#define TIMER_SERVICE_TRACE(event, timer, value) \
+    do {                                         \
+    } while (0)
+#define TIMER_SERVICE_TRACE_THREAD(name) ((void)0)
+#endif
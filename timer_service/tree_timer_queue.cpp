@@ -0,0 +1,82 @@
+#include "tree_timer_queue.h"
+
+TreeTimerQueue::TreeTimerQueue(size_t expected_timers)
+    : entry_pool_(expected_timers),
+      timer_pool_(expected_timers),
+      timers_(std::less<TimePoint>(), Timers::allocator_type(&timer_pool_)) {
+    entry_pool_.accepts(sizeof(Entry), alignof(Entry));
+}
+
+TreeTimerQueue::~TreeTimerQueue() {
+    for (auto& timer : timers_) {
+        destroy_(timer.second);
+    }
+}
+
+void TreeTimerQueue::destroy_(Entry* entry) {
+    entry->~Entry();
+    entry_pool_.deallocate(entry);
+}
+
+TimerData* TreeTimerQueue::push(TimePoint expiry, TimerData&& data) {
+    static_assert(alignof(Entry) <= alignof(std::max_align_t), "Tree entries must fit the node pool alignment");
+    Entry* entry = ::new (entry_pool_.allocate()) Entry(std::move(data));
+    TimePoint key = expiry + entry->slack;
+    // Timers of one delay, and restored snapshots, come in expiry order: appending at the end
+    // is amortised constant, without the descent from the root
+    if (!timers_.empty() && !(key < timers_.rbegin()->first)) {
+        entry->pos = timers_.emplace_hint(timers_.end(), key, entry);
+    } else {
+        entry->pos = timers_.emplace(key, entry);
+    }
+    return entry;
+}
+
+void TreeTimerQueue::erase(TimerData* data) {
+    Entry* entry = static_cast<Entry*>(data);
+    timers_.erase(entry->pos);
+    destroy_(entry);
+}
+
+void TreeTimerQueue::reposition(TimerData* data, TimePoint expiry) {
+    Entry* entry = static_cast<Entry*>(data);
+#ifdef __cpp_lib_node_extract
+    // Relink the tree node under its new key, rather than freeing it and building another
+    Timers::node_type node = timers_.extract(entry->pos);
+    node.key() = expiry + entry->slack;
+    entry->pos = timers_.insert(std::move(node));
+#else
+    timers_.erase(entry->pos);
+    entry->pos = timers_.emplace(expiry + entry->slack, entry);
+#endif
+}
+
+TreeTimerQueue::TimePoint TreeTimerQueue::expiry(const TimerData* data) const {
+    const Entry* entry = static_cast<const Entry*>(data);
+    return entry->pos->first - entry->slack;
+}
+
+TimerData* TreeTimerQueue::pop_expired(TimePoint now, TimePoint& expiry) {
+    auto it = timers_.begin();
+    if (it == timers_.end() || it->first - it->second->slack > now) {
+        return nullptr;
+    }
+    Entry* entry = it->second;
+    expiry = it->first - entry->slack;
+    timers_.erase(it);
+    entry->pos = timers_.end();
+    return entry;
+}
+
+void TreeTimerQueue::rearm(TimerData* data, TimePoint expiry) {
+    Entry* entry = static_cast<Entry*>(data);
+    entry->pos = timers_.emplace(expiry + entry->slack, entry);
+}
+
+void TreeTimerQueue::release(TimerData* data) {
+    destroy_(static_cast<Entry*>(data));
+}
+
+size_t TreeTimerQueue::memory_usage() const {
+    return entry_pool_.memory_usage() + timer_pool_.memory_usage();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "node_pool.h"
+#include "timer_queue.h"
+
+#include <map>
+
+/**
+ * Timer queue backed by an ordered multimap, timers fire at their exact expiry.
+ *
+ * Timers are ordered by expiry + slack, the point they must be served by. When woken up for
+ * the first one, the following ones whose expiry has passed are served along, like the
+ * soft/hard expiries of Linux hrtimers.
+ *
+ * The multimap only orders pointers to the timers, which live in pooled entries of their
+ * own so that a rearm repositions the key without moving the timer. Tree and entry nodes
+ * come from node pools, so steady state operation does not allocate.
+ */
+class TreeTimerQueue : public TimerQueue {
+public:
+    /**
+     * @param expected_timers Number of timers to reserve pool nodes for
+     */
+    explicit TreeTimerQueue(size_t expected_timers = 0);
+    ~TreeTimerQueue() override;
+
+    TreeTimerQueue(const TreeTimerQueue&) = delete;
+    TreeTimerQueue& operator=(const TreeTimerQueue&) = delete;
+
+    TimerData* push(TimePoint expiry, TimerData&& data) override;
+    void erase(TimerData* data) override;
+    void reposition(TimerData* data, TimePoint expiry) override;
+    TimePoint expiry(const TimerData* data) const override;
+    bool empty() const override { return timers_.empty(); }
+    size_t size() const override { return timers_.size(); }
+    TimePoint next_expiry() const override { return timers_.begin()->first; }
+    TimerData* pop_expired(TimePoint now, TimePoint& expiry) override;
+    void rearm(TimerData* data, TimePoint expiry) override;
+    void release(TimerData* data) override;
+    size_t memory_usage() const override;
+
+private:
+    struct Entry;
+
+    using Timers = std::multimap<TimePoint, Entry*, std::less<TimePoint>,
+                                 PoolAllocator<std::pair<const TimePoint, Entry*>>>;
+
+    struct Entry : TimerData {
+        explicit Entry(TimerData&& data) : TimerData(std::move(data)) {}
+
+        Timers::iterator pos;  // Position in timers_, end() while detached
+    };
+
+    void destroy_(Entry* entry);
+
+    NodePool entry_pool_;
+    NodePool timer_pool_;
+    Timers timers_; // Ordered by expiration time
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "indexed_heap.h"
+#include "timer_queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Timer service for a homogeneous population of timers that all call the same handler with
+ * an argument of the same type, typically a connection or request id.
+ *
+ * Where TimerService erases every callback and its argument into a 64 byte TimerCallback,
+ * here the handler is stored once and each timer only holds its Arg, so a timer costs a
+ * 16 byte heap key plus a small node, and firing is a direct, inlinable call. Timers live in
+ * a slab that never moves and are ordered by the 4-ary IndexedHeap of HeapTimerQueue. A single
+ * worker thread runs the handler, which may schedule and cancel timers.
+ *
+ * Trades the features of TimerService (options, groups, executor, threadless mode...) for
+ * footprint, use TimerService for anything else.
+ *
+ * @tparam Handler Callable invoked as handler(arg), with arg an Arg lvalue
+ * @tparam Arg Argument stored in every timer, must be default constructible and move assignable
+ */
+template<typename Handler, typename Arg>
+class TypedTimerService {
+public:
+    using TimerId = TimerData::Id;
+
+    /**
+     * @param handler Called on the worker thread for every expiry
+     * @param expected_timers Number of timers to reserve heap keys and nodes for
+     */
+    explicit TypedTimerService(Handler handler, size_t expected_timers = 0)
+        : handler_(std::move(handler)), heap_(NodePosition{&nodes_}), running_(true) {
+        heap_.reserve(expected_timers);
+        free_nodes_.reserve(expected_timers);
+        while (nodes_.size() < expected_timers) {
+            add_node_();
+        }
+        worker_thread_ = std::thread(&TypedTimerService::worker_, this);
+    }
+
+    ~TypedTimerService() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        worker_thread_.join();
+    }
+
+    TypedTimerService(const TypedTimerService&) = delete;
+    TypedTimerService& operator=(const TypedTimerService&) = delete;
+
+    /**
+     * Schedule a timer that will call the handler with the given argument after delay.
+     *
+     * @param delay Time to wait before calling the handler, any std::chrono::duration
+     * @param arg Argument to pass to the handler, the same object on every repetition
+     * @param repeat: 0 for a single shot timer, a negative value for an endless timer and any positive value for specifc repeat count
+     * @return TimerId that can be used to cancel the timer
+     */
+    template<typename Rep, typename Period>
+    TimerId schedule(std::chrono::duration<Rep, Period> delay, Arg arg, int repeat = 0) {
+        auto period = std::chrono::duration_cast<TimePoint::duration>(delay);
+        auto expiry = std::chrono::steady_clock::now() + period;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (free_nodes_.empty()) {
+            add_node_();
+        }
+        Node& node = nodes_[free_nodes_.back()];
+        free_nodes_.pop_back();
+        node.arg = std::move(arg);
+        node.repeat = repeat;
+        node.period = period;
+        node.cancelled = false;
+        heap_.push(Key{expiry, node.index});
+        bool earliest = node.heap_pos == 0;
+        TimerId id = encode_(node);
+        lock.unlock();
+        // After unlocking, so that the worker does not wake up straight into the held lock
+        if (earliest) {
+            cv_.notify_one(); // Wake up worker, the new timer is the earliest
+        }
+        return id;
+    }
+
+    /**
+     * Cancel a scheduled timer by ID.
+     *
+     * @param id Timer ID returned from schedule()
+     * @return true if timer was found and cancelled, false otherwise
+     */
+    bool cancel(TimerId id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Node* node = find_(id);
+        if (!node) {
+            return false;
+        }
+        if (node->heap_pos == kDetached) {
+            // Firing, stop its next repetition, the worker releases it once the handler returns
+            if (node->repeat == 0) {
+                return false;
+            }
+            node->cancelled = true;
+            ++node->generation;
+            return true;
+        }
+        // No wake-up: the worker at worst wakes once for nothing
+        remove_(node->heap_pos);
+        release_(*node);
+        return true;
+    }
+
+    /**
+     * Number of armed timers
+     */
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return heap_.size();
+    }
+
+    /**
+     * Bytes held by a timer: its heap key and node
+     */
+    static constexpr size_t bytes_per_timer() { return sizeof(Key) + sizeof(Node); }
+
+private:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    static constexpr uint32_t kDetached = UINT32_MAX;
+    static constexpr size_t kMaxBatch = 1024;
+
+    struct Key {
+        TimePoint key; // Expiry
+        uint32_t slot; // Node index
+    };
+
+    struct Node {
+        Arg arg{};
+        TimePoint::duration period{0};
+        int repeat = 0;
+        uint32_t index = 0;            // Position in nodes_
+        uint32_t heap_pos = kDetached; // Position in heap_, kDetached while firing or free
+        uint32_t generation = 1;       // Bumped on release, 0 once retired so that no id is 0
+        bool cancelled = false;        // Cancelled while its handler was running
+    };
+
+    struct NodePosition {
+        std::deque<Node>* nodes;
+        uint32_t& operator()(uint32_t slot) const { return (*nodes)[slot].heap_pos; }
+    };
+
+    // Timer taken out of the heap by the worker, with the expiry it fired for
+    struct Expired {
+        Node* node;
+        TimePoint expiry;
+    };
+
+    static TimerId encode_(const Node& node) {
+        return (TimerId(node.generation) << 32) | node.index;
+    }
+
+    /**
+     * @return the node of a live id, nullptr for a stale or invalid one
+     */
+    Node* find_(TimerId id) {
+        uint64_t index = id & UINT32_MAX;
+        if (index >= nodes_.size()) {
+            return nullptr;
+        }
+        Node& node = nodes_[size_t(index)];
+        uint32_t generation = uint32_t(id >> 32);
+        return generation == node.generation && generation != 0 && !node.cancelled ? &node : nullptr;
+    }
+
+    void add_node_() {
+        nodes_.emplace_back();
+        nodes_.back().index = uint32_t(nodes_.size() - 1);
+        free_nodes_.push_back(nodes_.back().index);
+    }
+
+    void release_(Node& node) {
+        // Drop the resources the argument holds now, the node stays for reuse
+        node.arg = Arg();
+        node.heap_pos = kDetached;
+        // A node cancelled while firing already stopped matching its id
+        if (node.cancelled) {
+            node.cancelled = false;
+        } else {
+            ++node.generation;
+        }
+        // Retired once its generation wraps, rather than handing out its first ids again: one
+        // node lost every 2^32 reuses
+        if (node.generation != 0) {
+            free_nodes_.push_back(node.index);
+        }
+    }
+
+    void worker_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_) {
+            if (heap_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            TimePoint now = std::chrono::steady_clock::now();
+            while (!heap_.empty() && heap_.front().key <= now && batch_.size() < kMaxBatch) {
+                batch_.push_back(Expired{&nodes_[heap_.front().slot], heap_.front().key});
+                remove_(0);
+            }
+            if (batch_.empty()) {
+                cv_.wait_until(lock, heap_.front().key);
+                continue;
+            }
+
+            // Release the lock before running the handler, nodes never move
+            lock.unlock();
+            for (const Expired& expired : batch_) {
+                handler_(expired.node->arg);
+            }
+            lock.lock();
+            for (const Expired& expired : batch_) {
+                Node& node = *expired.node;
+                if (node.cancelled || node.repeat == 0) {
+                    release_(node);
+                    continue;
+                }
+                if (node.repeat > 0) {
+                    --node.repeat;
+                }
+                // From the expiry it fired for, so that late handlers do not drift the schedule
+                heap_.push(Key{expired.expiry + node.period, node.index});
+            }
+            batch_.clear();
+        }
+    }
+
+    void remove_(uint32_t pos) {
+        nodes_[heap_.remove(pos)].heap_pos = kDetached;
+    }
+
+    Handler handler_;
+    std::thread worker_thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Node> nodes_; // Slab, a deque so that nodes never move when it grows
+    IndexedHeap<Key, NodePosition> heap_;
+    std::vector<uint32_t> free_nodes_;
+    std::vector<Expired> batch_; // Worker only, reused across wake-ups
+    bool running_;               // Guarded by mutex_
+};
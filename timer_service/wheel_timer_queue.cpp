@@ -0,0 +1,253 @@
+#include "wheel_timer_queue.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+WheelTimerQueue::WheelTimerQueue(std::chrono::nanoseconds tick, unsigned levels, unsigned slot_bits,
+                                 size_t expected_timers, TimePoint origin)
+    : tick_(tick),
+      levels_(levels),
+      slot_bits_(slot_bits),
+      slot_mask_((uint64_t(1) << slot_bits) - 1),
+      origin_(origin),
+      slots_(size_t(levels) << slot_bits),
+      node_pool_(expected_timers) {
+    if (tick.count() <= 0 || levels == 0 || slot_bits == 0 || levels * slot_bits >= 64) {
+        throw std::invalid_argument("WheelTimerQueue: invalid wheel geometry");
+    }
+}
+
+WheelTimerQueue::~WheelTimerQueue() {
+    for (Link& slot : slots_) {
+        clear_(slot);
+    }
+    clear_(overflow_);
+    clear_(due_);
+}
+
+void WheelTimerQueue::clear_(Link& list) {
+    while (list.next != &list) {
+        Node* node = static_cast<Node*>(list.next);
+        unlink_(node);
+        delete_node_(node);
+    }
+}
+
+WheelTimerQueue::Node* WheelTimerQueue::new_node_(TimerData&& data) {
+    static_assert(alignof(Node) <= alignof(std::max_align_t), "Wheel nodes must fit the node pool alignment");
+    node_pool_.accepts(sizeof(Node), alignof(Node));
+    return ::new (node_pool_.allocate()) Node(std::move(data));
+}
+
+void WheelTimerQueue::delete_node_(Node* node) {
+    node->~Node();
+    node_pool_.deallocate(node);
+}
+
+void WheelTimerQueue::unlink_(Link* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = node;
+}
+
+void WheelTimerQueue::link_back_(Link& list, Link* node) {
+    node->prev = list.prev;
+    node->next = &list;
+    list.prev->next = node;
+    list.prev = node;
+}
+
+TimerData* WheelTimerQueue::push(TimePoint expiry, TimerData&& data) {
+    Node* node = new_node_(std::move(data));
+    arm_(node, expiry);
+    return node;
+}
+
+void WheelTimerQueue::arm_(Node* node, TimePoint expiry) {
+    node->expiry = expiry;
+    // Round up so that a timer never fires before its expiry
+    auto offset = expiry - origin_;
+    uint64_t first = offset.count() <= 0 ? 0 : uint64_t((offset + tick_ - std::chrono::nanoseconds(1)) / tick_);
+    node->tick = first;
+    if (node->slack.count() > 0) {
+        // Latest tick still within the slack, then the most aligned tick of the window
+        uint64_t last = uint64_t(std::max<int64_t>(0, (offset + node->slack) / tick_));
+        for (unsigned bit = 0; bit < 64 && last > first; ++bit) {
+            uint64_t aligned = last & ~((uint64_t(2) << bit) - 1);
+            if (aligned < first) {
+                break;
+            }
+            last = aligned;
+        }
+        node->tick = std::max(first, last);
+    }
+    place_(node);
+    ++size_;
+}
+
+void WheelTimerQueue::place_(Node* node) {
+    if (node->tick < current_) {
+        link_back_(due_, node);
+        return;
+    }
+    // Lowest level whose higher digits are shared with current_
+    for (unsigned level = 0; level < levels_; ++level) {
+        unsigned shift = slot_bits_ * (level + 1);
+        if ((node->tick >> shift) == (current_ >> shift)) {
+            Link& slot = slot_(level, (node->tick >> (slot_bits_ * level)) & slot_mask_);
+            link_back_(slot, node);
+            // The slot is processed at its first tick, the node tick with the lower digits cleared
+            note_event_(node->tick & ~((uint64_t(1) << (slot_bits_ * level)) - 1), slot);
+            return;
+        }
+    }
+    link_back_(overflow_, node);
+    unsigned shift = slot_bits_ * levels_;
+    uint64_t low_mask = (uint64_t(1) << shift) - 1;
+    note_event_((current_ & low_mask) == 0 ? current_ : ((current_ >> shift) + 1) << shift, overflow_);
+}
+
+void WheelTimerQueue::note_event_(uint64_t tick, const Link& list) {
+    if (tick < next_event_) {
+        next_event_ = tick;
+        next_event_list_ = &list;
+    }
+}
+
+void WheelTimerQueue::detach_(Node* node) {
+    // Last node of its list, when the list is the one next_event_ waits for
+    bool last = node->next == next_event_list_ && node->prev == next_event_list_;
+    unlink_(node);
+    if (last) {
+        refresh_next_event_();
+    }
+}
+
+void WheelTimerQueue::erase(TimerData* data) {
+    Node* node = static_cast<Node*>(data);
+    detach_(node);
+    delete_node_(node);
+    --size_;
+}
+
+void WheelTimerQueue::reposition(TimerData* data, TimePoint expiry) {
+    Node* node = static_cast<Node*>(data);
+    detach_(node);
+    --size_;
+    arm_(node, expiry);
+}
+
+WheelTimerQueue::TimePoint WheelTimerQueue::expiry(const TimerData* data) const {
+    return static_cast<const Node*>(data)->expiry;
+}
+
+void WheelTimerQueue::refresh_next_event_() {
+    // A higher level usually cascades after every slot of the lower ones, except when
+    // current_ sits on a boundary whose cascade is still pending, hence the minimum
+    next_event_ = kNoTick;
+    next_event_list_ = nullptr;
+    for (unsigned level = 0; level < levels_; ++level) {
+        unsigned shift = slot_bits_ * level;
+        uint64_t base = (current_ >> (shift + slot_bits_)) << (shift + slot_bits_);
+        for (uint64_t digit = (current_ >> shift) & slot_mask_; digit <= slot_mask_; ++digit) {
+            uint64_t tick = base | (digit << shift);
+            const Link& slot = slot_(level, digit);
+            if (tick >= current_ && slot.next != &slot) {
+                note_event_(tick, slot);
+                break;
+            }
+        }
+        if (next_event_ == current_) {
+            return;
+        }
+    }
+    if (overflow_.next != &overflow_) {
+        unsigned shift = slot_bits_ * levels_;
+        uint64_t low_mask = (uint64_t(1) << shift) - 1;
+        note_event_((current_ & low_mask) == 0 ? current_ : ((current_ >> shift) + 1) << shift, overflow_);
+    }
+}
+
+void WheelTimerQueue::process_tick_() {
+    auto cascade = [this](Link& list) {
+        Link pending;
+        // Detach the whole list first as nodes may be placed back in a list being walked
+        if (list.next != &list) {
+            pending.next = list.next;
+            pending.prev = list.prev;
+            pending.next->prev = &pending;
+            pending.prev->next = &pending;
+            list.prev = list.next = &list;
+        }
+        while (pending.next != &pending) {
+            Link* node = pending.next;
+            unlink_(node);
+            place_(static_cast<Node*>(node));
+        }
+    };
+
+    if ((current_ & ((uint64_t(1) << (slot_bits_ * levels_)) - 1)) == 0) {
+        cascade(overflow_);
+    }
+    for (unsigned level = levels_ - 1; level > 0; --level) {
+        unsigned shift = slot_bits_ * level;
+        if ((current_ & ((uint64_t(1) << shift) - 1)) == 0) {
+            cascade(slot_(level, (current_ >> shift) & slot_mask_));
+        }
+    }
+
+    Link& slot = slot_(0, current_ & slot_mask_);
+    while (slot.next != &slot) {
+        Link* node = slot.next;
+        unlink_(node);
+        link_back_(due_, node);
+    }
+}
+
+void WheelTimerQueue::advance_(uint64_t tick) {
+    while (current_ <= tick) {
+        if (next_event_ == kNoTick || next_event_ > tick) {
+            // Nothing to do before tick, skip the empty slots at once. The cached tick stays
+            // valid: no slot before it was passed.
+            current_ = tick + 1;
+            return;
+        }
+        current_ = next_event_;
+        process_tick_();
+        ++current_;
+        refresh_next_event_();
+    }
+}
+
+WheelTimerQueue::TimePoint WheelTimerQueue::next_expiry() const {
+    if (due_.next != &due_) {
+        return static_cast<const Node*>(due_.next)->expiry;
+    }
+    return origin_ + std::chrono::duration_cast<TimePoint::duration>(tick_ * next_event_);
+}
+
+TimerData* WheelTimerQueue::pop_expired(TimePoint now, TimePoint& expiry) {
+    if (now >= origin_) {
+        advance_(uint64_t((now - origin_) / tick_));
+    }
+    if (due_.next == &due_) {
+        return nullptr;
+    }
+    Node* node = static_cast<Node*>(due_.next);
+    unlink_(node);
+    expiry = node->expiry;
+    --size_;
+    return node;
+}
+
+void WheelTimerQueue::rearm(TimerData* data, TimePoint expiry) {
+    arm_(static_cast<Node*>(data), expiry);
+}
+
+void WheelTimerQueue::release(TimerData* data) {
+    delete_node_(static_cast<Node*>(data));
+}
+
+size_t WheelTimerQueue::memory_usage() const {
+    return slots_.capacity() * sizeof(Link) + node_pool_.memory_usage();
+}
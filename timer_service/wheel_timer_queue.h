@@ -0,0 +1,130 @@
+#pragma once
+
+#include "node_pool.h"
+#include "timer_queue.h"
+
+#include <vector>
+
+/**
+ * Timer queue backed by a hierarchical timing wheel.
+ *
+ * Time is divided in ticks of a fixed resolution. Level 0 holds one slot per tick for the
+ * next 2^slot_bits ticks, every higher level covers 2^slot_bits slots of the level below.
+ * Timers are cascaded down a level when the wheel reaches their slot, so insert, cancel
+ * and expiry are O(1). Timers fire on the first tick at or after their expiry, i.e. up to
+ * one tick late. Timers beyond the range of the top level wait in an overflow list.
+ *
+ * A timer with slack goes to the tick of its window with the most trailing zero bits, so
+ * that timers with overlapping windows fall in the same slot and fire with one wake-up.
+ */
+class WheelTimerQueue : public TimerQueue {
+public:
+    /**
+     * @param tick Resolution of the wheel
+     * @param levels Number of wheel levels
+     * @param slot_bits log2 of the number of slots per level
+     * @param expected_timers Number of timers to reserve pool nodes for
+     * @param origin Start of the first tick, now unless driven by a virtual clock
+     */
+    WheelTimerQueue(std::chrono::nanoseconds tick, unsigned levels, unsigned slot_bits,
+                    size_t expected_timers = 0, TimePoint origin = std::chrono::steady_clock::now());
+    ~WheelTimerQueue() override;
+
+    WheelTimerQueue(const WheelTimerQueue&) = delete;
+    WheelTimerQueue& operator=(const WheelTimerQueue&) = delete;
+
+    TimerData* push(TimePoint expiry, TimerData&& data) override;
+    void erase(TimerData* data) override;
+    void reposition(TimerData* data, TimePoint expiry) override;
+    TimePoint expiry(const TimerData* data) const override;
+    bool empty() const override { return size_ == 0; }
+    size_t size() const override { return size_; }
+    TimePoint next_expiry() const override;
+    TimerData* pop_expired(TimePoint now, TimePoint& expiry) override;
+    void rearm(TimerData* data, TimePoint expiry) override;
+    void release(TimerData* data) override;
+    size_t memory_usage() const override;
+
+private:
+    static constexpr uint64_t kNoTick = UINT64_MAX;
+
+    // Intrusive circular list hook, slots are sentinels of their timer list.
+    // A node linked to itself is detached.
+    struct Link {
+        Link* prev = this;
+        Link* next = this;
+    };
+
+    struct Node : Link, TimerData {
+        explicit Node(TimerData&& data) : TimerData(std::move(data)) {}
+
+        TimePoint expiry;
+        uint64_t tick;
+    };
+
+    Node* new_node_(TimerData&& data);
+    void delete_node_(Node* node);
+
+    /**
+     * Destroy every node of a list
+     */
+    void clear_(Link& list);
+
+    /**
+     * Set the expiry of a detached node and place it
+     */
+    void arm_(Node* node, TimePoint expiry);
+
+    static void unlink_(Link* node);
+    static void link_back_(Link& list, Link* node);
+
+    /**
+     * Put a node in the slot matching its tick relative to current_
+     */
+    void place_(Node* node);
+
+    /**
+     * Process the wheel up to, and including, the given tick
+     */
+    void advance_(uint64_t tick);
+
+    /**
+     * Cascade higher levels and move the level 0 slot of current_ to the due list
+     */
+    void process_tick_();
+
+    /**
+     * Unlink a node from its list, refreshing next_event_ if the list it was due with empties
+     */
+    void detach_(Node* node);
+
+    /**
+     * Lower next_event_ to the tick a list is due at, if earlier
+     */
+    void note_event_(uint64_t tick, const Link& list);
+
+    /**
+     * Set next_event_ to the first tick at or after current_ with work to do (fire or
+     * cascade), kNoTick if none, scanning every level
+     */
+    void refresh_next_event_();
+
+    Link& slot_(unsigned level, uint64_t index) { return slots_[(level << slot_bits_) + index]; }
+    const Link& slot_(unsigned level, uint64_t index) const { return slots_[(level << slot_bits_) + index]; }
+
+    const std::chrono::nanoseconds tick_;
+    const unsigned levels_;
+    const unsigned slot_bits_;
+    const uint64_t slot_mask_;
+    const TimePoint origin_;    // Start of tick 0
+    uint64_t current_ = 0;      // Next tick to process
+    size_t size_ = 0;
+    std::vector<Link> slots_;   // levels_ * 2^slot_bits_ slots
+    Link overflow_;             // Timers beyond the range of the top level
+    Link due_;                  // Timers whose tick has been processed
+    // Cached first tick with work to do, so that next_expiry() does not scan the levels. Only
+    // placing a timer lowers it; advancing, or emptying next_event_list_, recomputes it.
+    uint64_t next_event_ = kNoTick;
+    const Link* next_event_list_ = nullptr;
+    NodePool node_pool_;
+};